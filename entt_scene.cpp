@@ -1,11 +1,37 @@
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <optional>
+#include <sstream>
+#include <string_view>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <cassert>
 #include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
 
 #include "entt/entt.hpp"
 
@@ -26,6 +52,9 @@ const Vec3 Vec3::one = {1, 1, 1};
 
 Vec3 operator+(const Vec3 &a, const Vec3 &b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
 
+bool operator==(const Vec3 &a, const Vec3 &b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+bool operator!=(const Vec3 &a, const Vec3 &b) { return !(a == b); }
+
 std::ostream &operator<<(std::ostream &out, const Vec3 &v)
 {
     return out << "Vec3: " << v.x << " " << v.y << " " << v.z;
@@ -41,32 +70,116 @@ struct Transform {
 // Operator for combining Transforms.
 Transform operator*(const Transform &a, const Transform &b) { return {a.position + b.position}; }
 
+bool operator==(const Transform &a, const Transform &b) { return a.position == b.position; }
+bool operator!=(const Transform &a, const Transform &b) { return !(a == b); }
+
 std::ostream &operator<<(std::ostream &out, const Transform &t) { return out << "Transform: " << t.position; }
 
+// Packed copy of a SceneNode's global transform, see updateTransformGroup.
+struct GlobalTransform {
+    Transform value;
+};
+
+// Position of a SceneNode in the parent-first order of its scene, see
+// updateTransformGroup.
+struct HierarchyOrder {
+    std::uint32_t depth = 0;
+    std::uint32_t index = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Records entities whose local transform changed, so that many threads can
+// write transforms concurrently and leave propagation to a single later pass.
+//
+// Pushing is lock-free: entries are claimed from a preallocated array with an
+// atomic increment. Should the array run full, entries go to a lock-free
+// overflow list instead and the array grows on the next take().
+class TransformDirtyQueue
+{
+  public:
+    explicit TransformDirtyQueue(std::size_t capacity = 1024) : m_slots(capacity) {}
+
+    ~TransformDirtyQueue() { releaseOverflow(); }
+
+    TransformDirtyQueue(const TransformDirtyQueue &) = delete;
+    TransformDirtyQueue &operator=(const TransformDirtyQueue &) = delete;
+
+    // Safe to call from any number of threads.
+    void push(entt::entity e)
+    {
+        if (const auto index = m_size.fetch_add(1, std::memory_order_relaxed); index < m_slots.size()) {
+            m_slots[index] = e;
+            return;
+        }
+
+        auto *entry = new Overflow{e, m_overflow.load(std::memory_order_relaxed)};
+        while (!m_overflow.compare_exchange_weak(entry->next, entry, std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+        }
+    }
+
+    // Removes and returns all recorded entities, without duplicates. Must not
+    // run concurrently with push().
+    std::vector<entt::entity> take()
+    {
+        const auto size = m_size.exchange(0);
+
+        const auto claimed = std::ptrdiff_t(std::min(size, m_slots.size()));
+        std::vector<entt::entity> entities(m_slots.begin(), m_slots.begin() + claimed);
+        for (auto *entry = m_overflow.load(std::memory_order_acquire); entry; entry = entry->next) {
+            entities.push_back(entry->entity);
+        }
+        releaseOverflow();
+
+        if (size > m_slots.size()) {
+            m_slots.resize(size);
+        }
+
+        std::sort(entities.begin(), entities.end());
+        entities.erase(std::unique(entities.begin(), entities.end()), entities.end());
+        return entities;
+    }
+
+  private:
+    struct Overflow {
+        entt::entity entity;
+        Overflow *next;
+    };
+
+    std::vector<entt::entity> m_slots;
+    std::atomic<std::size_t> m_size{0};
+    std::atomic<Overflow *> m_overflow{nullptr};
+
+    void releaseOverflow()
+    {
+        for (auto *entry = m_overflow.exchange(nullptr); entry;) {
+            delete std::exchange(entry, entry->next);
+        }
+    }
+};
+
 //////////////////////////////////////////////////////////////////////////
 
+class SceneGraph;
+struct FlatScene;
+struct FlatSceneView;
+class IncrementalSceneLoader;
+class SceneCheckpointRing;
+struct TransformsChanged;
+
 // A SceneNode contains an entity's local Transform as well as references to
 // parent and child nodes. Additionally it provides a reference to the
 // corresponding entity. Ownership is managed by the entity component system.
 //
 // The following invariants are maintained:
-// - Parent and child references are kept consistent.
+// - Parent and child references are kept consistent, also when a SceneNode is
+//   destroyed (see unlinkSceneNode).
 // - Combined parent transforms are cached. This cache is invalided
 //   automatically.
 class SceneNode
 {
   public:
-    ~SceneNode()
-    {
-        if (m_parent) {
-            m_parent->removeChild(this);
-        }
-
-        for (const auto &child : m_children) {
-            child->clearParent();
-        }
-    }
-
     entt::entity entity() const { return m_entity; }
 
     const Transform &transform() const { return m_transform; }
@@ -77,6 +190,16 @@ class SceneNode
         m_transform = transform;
     }
 
+    // Sets the local transform without touching any other node and records
+    // the change in the given queue. Different nodes may be written from
+    // different threads this way; descendants see the new transform once the
+    // queue has been passed to propagateTransforms.
+    void setTransform(const Transform &transform, TransformDirtyQueue &dirty)
+    {
+        m_transform = transform;
+        dirty.push(m_entity);
+    }
+
     Transform parentTransform() const
     {
         if (!m_cachedParentTransform) {
@@ -90,6 +213,25 @@ class SceneNode
 
     SceneNode *parent() const { return m_parent; }
 
+    // Number of ancestors, roots having depth 0.
+    std::uint32_t depth() const { return m_depth; }
+
+    // Deactivating a node takes its whole subtree out of whole-scene passes,
+    // like SceneGraph::forEachNode and propagateTransforms, at constant cost.
+    bool active() const { return m_active; }
+
+    bool activeInHierarchy() const
+    {
+        for (auto *node = this; node; node = node->m_parent) {
+            if (!node->m_active) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void setActive(bool active);
+
     const std::vector<SceneNode *> &children() const { return m_children; }
 
     void addChild(SceneNode *child)
@@ -124,11 +266,23 @@ class SceneNode
     SceneNode *m_parent = nullptr;
     std::vector<SceneNode *> m_children;
 
-    void setParent(SceneNode *parent)
-    {
-        invalidateCachedParentTransform();
-        m_parent = parent;
-    }
+    std::uint32_t m_depth = 0;
+
+    bool m_active = true;
+
+    SceneGraph *m_graph = nullptr;
+    std::uint32_t m_rootIndex = noRootIndex;
+    std::uint32_t m_levelIndex = 0;
+
+    static constexpr std::uint32_t noRootIndex = ~std::uint32_t(0);
+
+    void setParent(SceneNode *parent);
+
+    void setDepth(std::uint32_t depth);
+
+    // Links a freshly created child without walking its subtree for
+    // invalidation, as it has no cached parent transform yet.
+    void addFreshChild(SceneNode *child);
 
     void clearParent() { setParent(nullptr); }
 
@@ -147,7 +301,38 @@ class SceneNode
         }
     }
 
+    // Appends the entities of this node's subtree to out, in pre-order, and
+    // drops all links inside it without invalidating any caches. The subtree
+    // is expected to be destroyed right after.
+    void unlinkSubtreeForDestruction(std::vector<entt::entity> &out)
+    {
+        std::vector<SceneNode *> stack = {this};
+        while (!stack.empty()) {
+            auto *node = stack.back();
+            stack.pop_back();
+
+            out.push_back(node->m_entity);
+            node->m_parent = nullptr;
+
+            stack.insert(stack.end(), node->m_children.rbegin(), node->m_children.rend());
+            node->m_children.clear();
+        }
+    }
+
+    friend class SceneGraph;
+    friend class IncrementalSceneLoader;
+    friend class SceneCheckpointRing;
     friend void linkSceneNodeWithEntity(entt::registry &, entt::entity);
+    friend void unregisterSceneNodeCallbacks(entt::registry &);
+    friend void unlinkSceneNode(entt::registry &, entt::entity);
+    template <typename It>
+    friend void destroySceneNodes(entt::registry &, It, It);
+    friend void destroySubtree(entt::registry &, entt::entity, unsigned);
+    template <typename It>
+    friend void collectPropagatedTransforms(entt::registry &, It, It, TransformsChanged *);
+    friend void patchTransform(entt::registry &, entt::entity, const Transform &);
+    friend std::vector<entt::entity> instantiateFlatScene(entt::registry &, const FlatSceneView &, SceneNode *);
+    friend void linkSceneNodes(entt::registry &, const std::vector<std::pair<entt::entity, entt::entity>> &);
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -159,59 +344,3715 @@ struct entt::component_traits<SceneNode> : entt::basic_component_traits {
     using in_place_delete = std::true_type;
 };
 
+// Registry-wide state of the scene graph. registerSceneNodeCallbacks stores one
+// in the registry context, where it is kept up to date by the SceneNode
+// callbacks and by SceneNode itself.
+//
+// All roots are indexed, so whole-scene passes can start from them directly
+// instead of testing every SceneNode for a parent. Scratch memory for such
+// passes is kept around between frames.
+class SceneGraph
+{
+  public:
+    SceneGraph() = default;
+
+    // SceneNodes point to their graph, hence it must never move.
+    SceneGraph(const SceneGraph &) = delete;
+    SceneGraph &operator=(const SceneGraph &) = delete;
+
+    // Returns all roots. The first activeRootCount() of them are active, the
+    // remaining ones are skipped by whole-scene passes.
+    const std::vector<SceneNode *> &roots() const { return m_roots; }
+
+    std::size_t activeRootCount() const { return m_activeRootCount; }
+
+    std::size_t nodeCount() const { return m_nodeCount; }
+
+    // Returns the depth of the deepest node, roots having depth 0.
+    std::size_t maxDepth() const { return m_levels.empty() ? 0 : m_levels.size() - 1; }
+
+    // Returns all nodes at the given depth, in no particular order. Inactive
+    // nodes are included.
+    const std::vector<SceneNode *> &nodesAtDepth(std::size_t depth) const
+    {
+        static const std::vector<SceneNode *> none;
+        return depth < m_levels.size() ? m_levels[depth] : none;
+    }
+
+    // Visits all active nodes parent-first, starting from the roots. Inactive
+    // subtrees are skipped as a whole. The traversal uses the graph's scratch
+    // memory, so func must neither modify the hierarchy nor start another
+    // traversal.
+    template <typename Func>
+    void forEachNode(Func func) const
+    {
+        auto &queue = m_scratch;
+        queue.assign(m_roots.begin(), m_roots.begin() + std::ptrdiff_t(m_activeRootCount));
+        for (std::size_t i = 0; i < queue.size(); ++i) {
+            func(*queue[i]);
+            for (auto *child : queue[i]->m_children) {
+                if (child->m_active) {
+                    queue.push_back(child);
+                }
+            }
+        }
+    }
+
+  private:
+    std::vector<SceneNode *> m_roots;
+    std::size_t m_activeRootCount = 0;
+    std::size_t m_nodeCount = 0;
+
+    // Nodes grouped by depth, each node knowing its position in its level.
+    std::vector<std::vector<SceneNode *>> m_levels;
+
+    mutable std::vector<SceneNode *> m_scratch;
+
+    void addNode(SceneNode *node)
+    {
+        node->m_graph = this;
+        node->m_depth = 0;
+        ++m_nodeCount;
+        addToLevel(node);
+        updateRoot(node);
+    }
+
+    // Adds SceneNodes created while the registry had no graph. As their entity
+    // links and depths may be stale, both are recomputed, going down from the
+    // roots.
+    void addExistingNodes(entt::registry &reg)
+    {
+        std::vector<SceneNode *> queue;
+        for (auto [e, node] : reg.view<SceneNode>().each()) {
+            node.m_entity = e;
+            if (!node.m_parent) {
+                node.m_depth = 0;
+                queue.push_back(&node);
+            }
+        }
+
+        for (std::size_t i = 0; i < queue.size(); ++i) {
+            auto *node = queue[i];
+            node->m_graph = this;
+            ++m_nodeCount;
+            addToLevel(node);
+            updateRoot(node);
+
+            for (auto *child : node->m_children) {
+                child->m_depth = node->m_depth + 1;
+                queue.push_back(child);
+            }
+        }
+    }
+
+    void removeNode(SceneNode *node)
+    {
+        if (node->m_rootIndex != SceneNode::noRootIndex) {
+            removeRoot(node);
+        }
+        removeFromLevel(node);
+
+        node->m_graph = nullptr;
+        --m_nodeCount;
+    }
+
+    void addToLevel(SceneNode *node)
+    {
+        if (node->m_depth >= m_levels.size()) {
+            m_levels.resize(node->m_depth + 1);
+        }
+
+        auto &level = m_levels[node->m_depth];
+        node->m_levelIndex = std::uint32_t(level.size());
+        level.push_back(node);
+    }
+
+    void removeFromLevel(SceneNode *node)
+    {
+        auto &level = m_levels[node->m_depth];
+        auto *last = level.back();
+        last->m_levelIndex = node->m_levelIndex;
+        level[node->m_levelIndex] = last;
+        level.pop_back();
+
+        while (!m_levels.empty() && m_levels.back().empty()) {
+            m_levels.pop_back();
+        }
+    }
+
+    // Adds or removes the node from the root index, according to whether it
+    // has a parent.
+    void updateRoot(SceneNode *node)
+    {
+        const bool indexed = node->m_rootIndex != SceneNode::noRootIndex;
+        if (!node->m_parent && !indexed) {
+            addRoot(node);
+        } else if (node->m_parent && indexed) {
+            removeRoot(node);
+        }
+    }
+
+    // Roots are kept partitioned, active ones first.
+    void addRoot(SceneNode *node)
+    {
+        node->m_rootIndex = std::uint32_t(m_roots.size());
+        m_roots.push_back(node);
+
+        if (node->m_active) {
+            swapRoots(node->m_rootIndex, m_activeRootCount++);
+        }
+    }
+
+    void removeRoot(SceneNode *node)
+    {
+        if (node->m_rootIndex < m_activeRootCount) {
+            swapRoots(node->m_rootIndex, --m_activeRootCount);
+        }
+
+        swapRoots(node->m_rootIndex, m_roots.size() - 1);
+        m_roots.pop_back();
+        node->m_rootIndex = SceneNode::noRootIndex;
+    }
+
+    void swapRoots(std::size_t a, std::size_t b)
+    {
+        std::swap(m_roots[a], m_roots[b]);
+        m_roots[a]->m_rootIndex = std::uint32_t(a);
+        m_roots[b]->m_rootIndex = std::uint32_t(b);
+    }
+
+    friend class SceneNode;
+    friend void addSceneNodeToGraph(entt::registry &, entt::entity);
+    friend void unlinkSceneNode(entt::registry &, entt::entity);
+    friend void registerSceneNodeCallbacks(entt::registry &);
+};
+
+void SceneNode::setParent(SceneNode *parent)
+{
+    invalidateCachedParentTransform();
+    m_parent = parent;
+    setDepth(parent ? parent->m_depth + 1 : 0);
+
+    if (m_graph) {
+        m_graph->updateRoot(this);
+    }
+}
+
+void SceneNode::setActive(bool active)
+{
+    if (active == m_active) {
+        return;
+    }
+
+    m_active = active;
+
+    // Passes skipped this subtree while it was inactive, so its cached
+    // transforms may be outdated. They are recomputed on demand.
+    if (active) {
+        invalidateCachedParentTransform();
+    }
+
+    if (m_graph && !m_parent) {
+        m_graph->removeRoot(this);
+        m_graph->addRoot(this);
+    }
+}
+
+void SceneNode::addFreshChild(SceneNode *child)
+{
+    assert(!child->m_parent && !child->m_cachedParentTransform);
+
+    child->m_parent = this;
+    m_children.push_back(child);
+    child->setDepth(m_depth + 1);
+
+    if (child->m_graph) {
+        child->m_graph->updateRoot(child);
+    }
+}
+
+void SceneNode::setDepth(std::uint32_t depth)
+{
+    if (depth == m_depth) {
+        return;
+    }
+
+    // The whole subtree shifts by the same amount, which is applied in a
+    // single pass.
+    const auto shift = std::int64_t(depth) - std::int64_t(m_depth);
+    const auto moveLevel = [this, shift](SceneNode *node) {
+        if (m_graph) {
+            m_graph->removeFromLevel(node);
+        }
+        node->m_depth = std::uint32_t(node->m_depth + shift);
+        if (m_graph) {
+            m_graph->addToLevel(node);
+        }
+    };
+
+    // Leaves are the common case, e.g. every node linked by
+    // instantiateFlatScene, and need no stack.
+    if (m_children.empty()) {
+        moveLevel(this);
+        return;
+    }
+
+    std::vector<SceneNode *> stack = {this};
+    while (!stack.empty()) {
+        auto *node = stack.back();
+        stack.pop_back();
+
+        moveLevel(node);
+        stack.insert(stack.end(), node->m_children.begin(), node->m_children.end());
+    }
+}
+
 // Links an entity with its corresponding SceneNode. This function is used
 // automatically by the registry using the provide callback mechanism.
 void linkSceneNodeWithEntity(entt::registry &reg, entt::entity e) { reg.get<SceneNode>(e).m_entity = e; }
 
+// Registers a new SceneNode with the registry's SceneGraph, if there is one.
+// This function is used automatically by the registry as well.
+void addSceneNodeToGraph(entt::registry &reg, entt::entity e)
+{
+    if (auto *graph = reg.try_ctx<SceneGraph>()) {
+        graph->addNode(&reg.get<SceneNode>(e));
+    }
+}
+
+// Detaches a SceneNode that is about to be destroyed from its parent and its
+// children. This function is used automatically by the registry as well, which
+// keeps the SceneNode destructor free of side-effects.
+void unlinkSceneNode(entt::registry &reg, entt::entity e)
+{
+    auto &node = reg.get<SceneNode>(e);
+
+    if (node.m_parent) {
+        node.m_parent->removeChild(&node);
+    }
+
+    for (const auto &child : node.m_children) {
+        child->clearParent();
+    }
+    node.m_children.clear();
+
+    if (node.m_graph) {
+        node.m_graph->removeNode(&node);
+    }
+}
+
+// Registers the callbacks and a SceneGraph with the registry. SceneNodes which
+// already exist are added to the graph. Registering again has no effect.
 void registerSceneNodeCallbacks(entt::registry &reg)
 {
+    if (!reg.try_ctx<SceneGraph>()) {
+        reg.set<SceneGraph>().addExistingNodes(reg);
+    }
+
     reg.on_construct<SceneNode>().connect<&linkSceneNodeWithEntity>();
+    reg.on_construct<SceneNode>().connect<&addSceneNodeToGraph>();
     reg.on_update<SceneNode>().connect<&linkSceneNodeWithEntity>();
+    reg.on_destroy<SceneNode>().connect<&unlinkSceneNode>();
+    reg.on_destroy<SceneNode>().connect<&entt::registry::remove<GlobalTransform, HierarchyOrder>>();
 }
 
 void unregisterSceneNodeCallbacks(entt::registry &reg)
 {
     reg.on_construct<SceneNode>().disconnect<&linkSceneNodeWithEntity>();
+    reg.on_construct<SceneNode>().disconnect<&addSceneNodeToGraph>();
     reg.on_update<SceneNode>().disconnect<&linkSceneNodeWithEntity>();
+    reg.on_destroy<SceneNode>().disconnect<&unlinkSceneNode>();
+    reg.on_destroy<SceneNode>().disconnect<&entt::registry::remove<GlobalTransform, HierarchyOrder>>();
+
+    reg.view<SceneNode>().each([](SceneNode &node) {
+        node.m_graph = nullptr;
+        node.m_rootIndex = SceneNode::noRootIndex;
+        node.m_levelIndex = 0;
+    });
+    reg.unset<SceneGraph>();
 }
 
-//////////////////////////////////////////////////////////////////////////
+// Destroys a range of entities, unlinking all of their SceneNodes in one sweep
+// beforehand. Links between destroyed nodes are simply dropped. Every surviving
+// parent has its children filtered once, and only surviving children are
+// detached and invalidated.
+template <typename It>
+void destroySceneNodes(entt::registry &reg, It first, It last)
+{
+    std::vector<SceneNode *> doomed;
+    for (auto it = first; it != last; ++it) {
+        if (auto *node = reg.try_get<SceneNode>(*it)) {
+            doomed.push_back(node);
+        }
+    }
+    std::sort(doomed.begin(), doomed.end());
+
+    auto isDoomed = [&](SceneNode *node) { return std::binary_search(doomed.begin(), doomed.end(), node); };
 
-int main()
+    std::vector<SceneNode *> survivingParents;
+    for (auto *node : doomed) {
+        if (node->m_parent && !isDoomed(node->m_parent)) {
+            survivingParents.push_back(node->m_parent);
+        }
+        node->m_parent = nullptr;
+
+        for (auto *child : node->m_children) {
+            if (!isDoomed(child)) {
+                child->clearParent();
+            }
+        }
+        node->m_children.clear();
+    }
+
+    std::sort(survivingParents.begin(), survivingParents.end());
+    survivingParents.erase(std::unique(survivingParents.begin(), survivingParents.end()), survivingParents.end());
+    for (auto *parent : survivingParents) {
+        auto &children = parent->m_children;
+        children.erase(std::remove_if(children.begin(), children.end(), isDoomed), children.end());
+    }
+
+    reg.destroy(first, last);
+}
+
+// Destroys the given entity together with all of its descendants.
+//
+// Unlike destroying the entities one by one, only the root is detached from
+// its parent. Links inside the subtree are simply dropped, so no node is
+// unlinked or invalidated individually. The subtrees below the root's children
+// can be collected on multiple threads; the entities are then destroyed in one
+// bulk call.
+void destroySubtree(entt::registry &reg, entt::entity root, unsigned threadCount = 1)
 {
-    entt::registry reg;
-    registerSceneNodeCallbacks(reg);
+    auto &rootNode = reg.get<SceneNode>(root);
 
-    // Note the use of pointers for SceneNodes as the SceneNode interface
-    // prefers pointers over references.
+    if (auto *parent = rootNode.m_parent) {
+        auto &siblings = parent->m_children;
+        siblings.erase(std::find(siblings.begin(), siblings.end(), &rootNode));
+        rootNode.m_parent = nullptr;
+    }
 
-    auto ship = reg.create();
-    auto *shipNode = &reg.emplace<SceneNode>(ship);
+    auto children = std::move(rootNode.m_children);
+    rootNode.m_children.clear();
 
-    auto captain = reg.create();
-    auto *captainNode = &reg.emplace<SceneNode>(captain);
+    threadCount = std::clamp<unsigned>(threadCount, 1, std::max<std::size_t>(children.size(), 1));
 
-    // connect captain with his ship
-    {
-        shipNode->addChild(captainNode);
+    std::vector<std::vector<entt::entity>> chunks(threadCount);
+    auto collectChunk = [&](unsigned chunk) {
+        for (std::size_t i = chunk; i < children.size(); i += threadCount) {
+            children[i]->unlinkSubtreeForDestruction(chunks[chunk]);
+        }
+    };
 
-        assert(shipNode->children().at(0)->entity() == captain);
-        assert(captainNode->parent()->entity() == ship);
+    std::vector<std::thread> workers;
+    for (unsigned chunk = 1; chunk < threadCount; ++chunk) {
+        workers.emplace_back(collectChunk, chunk);
+    }
+    collectChunk(0);
+    for (auto &worker : workers) {
+        worker.join();
     }
 
-    // sail the sea
-    {
-        shipNode->setTransform({42, 42, 42});
+    std::vector<entt::entity> entities = {root};
+    for (const auto &chunk : chunks) {
+        entities.insert(entities.end(), chunk.begin(), chunk.end());
+    }
 
-        assert(captainNode->transform().position.x == 0); // local
-        assert(captainNode->globalTransform().position.x == 42);
+    reg.destroy(entities.begin(), entities.end());
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Pointer-free description of a hierarchy, used to move scenes between
+// registries. Nodes are stored parent-first: parents[i] is the index of node
+// i's parent, which is always smaller than i, or noParent for roots. entities
+// optionally records which entity each node was taken from. active holds each
+// node's own active flag, see SceneNode::setActive; if it is empty, all nodes
+// are active.
+struct FlatScene {
+    static constexpr std::uint32_t noParent = ~std::uint32_t(0);
+
+    std::vector<entt::entity> entities;
+    std::vector<std::uint32_t> parents;
+    std::vector<Transform> transforms;
+    std::vector<std::uint8_t> active;
+
+    std::size_t size() const { return parents.size(); }
+
+    FlatSceneView view() const;
+};
+
+// Read-only view of the parent indices, transforms and active flags of a
+// FlatScene, which may also point into a mapped scene file. active is null if
+// all nodes are active.
+struct FlatSceneView {
+    const std::uint32_t *parents = nullptr;
+    const Transform *transforms = nullptr;
+    std::size_t count = 0;
+    const std::uint8_t *active = nullptr;
+
+    std::size_t size() const { return count; }
+
+    bool isActive(std::size_t i) const { return !active || active[i]; }
+};
+
+FlatSceneView FlatScene::view() const
+{
+    assert(parents.size() == transforms.size());
+    assert(active.empty() || active.size() == parents.size());
+    return {parents.data(), transforms.data(), parents.size(), active.empty() ? nullptr : active.data()};
+}
+
+// Appends the subtree below root to the given FlatScene, in breadth-first
+// order. The root gets the given parent index. Inactive nodes are kept along
+// with their active flags, so copies made from the FlatScene stay inactive.
+void flattenSubtree(const SceneNode &root, FlatScene &out, std::uint32_t parent = FlatScene::noParent)
+{
+    const auto first = out.size();
+    out.active.resize(first, 1);
+
+    out.entities.push_back(root.entity());
+    out.parents.push_back(parent);
+    out.transforms.push_back(root.transform());
+    out.active.push_back(root.active());
+
+    std::vector<const SceneNode *> queue = {&root};
+    for (std::size_t i = 0; i < queue.size(); ++i) {
+        const auto index = std::uint32_t(first + i);
+        for (const auto *child : queue[i]->children()) {
+            out.entities.push_back(child->entity());
+            out.parents.push_back(index);
+            out.transforms.push_back(child->transform());
+            out.active.push_back(child->active());
+            queue.push_back(child);
+        }
     }
+}
 
-    // ship sinks :(
-    {
-        reg.destroy(ship);
+// Creates one entity with a SceneNode per node of the given FlatScene and links
+// them up. Entities and SceneNodes are created in bulk, and the links are
+// written directly instead of going through addChild. Roots of the FlatScene are
+// attached to attachTo, if given. Active flags are restored as well. Returns
+// the created entities in FlatScene order.
+std::vector<entt::entity> instantiateFlatScene(entt::registry &reg, const FlatSceneView &scene,
+                                               SceneNode *attachTo = nullptr)
+{
+    std::vector<entt::entity> entities(scene.size());
+    reg.create(entities.begin(), entities.end());
+    reg.insert<SceneNode>(entities.begin(), entities.end());
 
-        assert(captainNode->parent() == nullptr);
-        assert(captainNode->transform().position.x == captainNode->globalTransform().position.x);
+    std::vector<SceneNode *> nodes(scene.size());
+    std::vector<std::uint32_t> childCounts(scene.size());
+    for (std::size_t i = 0; i < scene.size(); ++i) {
+        nodes[i] = &reg.get<SceneNode>(entities[i]);
+        if (scene.parents[i] != FlatScene::noParent) {
+            ++childCounts[scene.parents[i]];
+        }
+    }
+
+    for (std::size_t i = 0; i < scene.size(); ++i) {
+        auto *node = nodes[i];
+        node->m_transform = scene.transforms[i];
+        node->m_children.reserve(childCounts[i]);
+
+        auto *parent = scene.parents[i] != FlatScene::noParent ? nodes[scene.parents[i]] : attachTo;
+        if (parent) {
+            assert(scene.parents[i] == FlatScene::noParent || scene.parents[i] < i);
+            parent->addFreshChild(node);
+        }
+
+        if (!scene.isActive(i)) {
+            node->setActive(false);
+        }
+    }
+
+    return entities;
+}
+
+std::vector<entt::entity> instantiateFlatScene(entt::registry &reg, const FlatScene &scene,
+                                               SceneNode *attachTo = nullptr)
+{
+    return instantiateFlatScene(reg, scene.view(), attachTo);
+}
+
+// Copies the subtree below srcRoot into another (or the same) registry and
+// attaches it to dstParent, unless that is null. Entities and SceneNodes are
+// created in bulk and linked in a single pass. Returns the root of the copy.
+entt::entity cloneSubtree(const entt::registry &src, entt::entity srcRoot, entt::registry &dst,
+                          entt::entity dstParent = entt::null)
+{
+    FlatScene scene;
+    flattenSubtree(src.get<SceneNode>(srcRoot), scene);
+
+    auto *attachTo = dstParent != entt::null ? &dst.get<SceneNode>(dstParent) : nullptr;
+    return instantiateFlatScene(dst, scene, attachTo).front();
+}
+
+// Moves all SceneNodes of a staging registry into the live registry. This allows
+// building large parts of a scene on a background thread without blocking the
+// live registry; only this call has to run in sync with it.
+//
+// Staging roots are attached to attachTo, if given. The staging registry is left
+// without SceneNodes. Returns pairs of staging and live entities, so that other
+// components can be carried over as well.
+std::vector<std::pair<entt::entity, entt::entity>> mergeStagedScene(entt::registry &live, entt::registry &staging,
+                                                                    SceneNode *attachTo = nullptr)
+{
+    FlatScene scene;
+    std::vector<entt::entity> roots;
+    for (const auto *root : staging.ctx<SceneGraph>().roots()) {
+        flattenSubtree(*root, scene);
+        roots.push_back(root->entity());
+    }
+
+    const auto entities = instantiateFlatScene(live, scene, attachTo);
+
+    for (const auto root : roots) {
+        destroySubtree(staging, root);
+    }
+
+    std::vector<std::pair<entt::entity, entt::entity>> remap(scene.size());
+    for (std::size_t i = 0; i < scene.size(); ++i) {
+        remap[i] = {scene.entities[i], entities[i]};
+    }
+    return remap;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Event listing every node whose global transform was recomputed by a
+// propagation pass, together with the new global transforms. It is enqueued
+// once per pass, so listeners handle all changes in one go instead of polling
+// every node.
+struct TransformsChanged {
+    std::vector<entt::entity> entities;
+    std::vector<Transform> globalTransforms;
+};
+
+// Refreshes the cached parent transforms below the given entities, whose local
+// transforms changed since the last pass. Only their subtrees are visited, and
+// an entity below another listed entity is covered by the latter's walk.
+// Entities which are no longer valid are skipped. If changed is not null,
+// every visited node is appended to it.
+template <typename It>
+void collectPropagatedTransforms(entt::registry &reg, It first, It last, TransformsChanged *changed)
+{
+    std::vector<SceneNode *> dirty;
+    for (; first != last; ++first) {
+        if (auto *node = reg.valid(*first) ? reg.try_get<SceneNode>(*first) : nullptr) {
+            dirty.push_back(node);
+        }
+    }
+
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    auto isDirty = [&](SceneNode *node) { return std::binary_search(dirty.begin(), dirty.end(), node); };
+
+    std::vector<SceneNode *> stack;
+    for (auto *node : dirty) {
+        // Skip nodes covered by a dirty ancestor as well as inactive ones.
+        bool skip = !node->m_active;
+        for (auto *ancestor = node->m_parent; ancestor && !skip; ancestor = ancestor->m_parent) {
+            skip = isDirty(ancestor) || !ancestor->m_active;
+        }
+        if (skip) {
+            continue;
+        }
+
+        stack.push_back(node);
+        while (!stack.empty()) {
+            const auto *parent = stack.back();
+            stack.pop_back();
+
+            const auto parentGlobal = parent->globalTransform();
+            if (changed) {
+                changed->entities.push_back(parent->m_entity);
+                changed->globalTransforms.push_back(parentGlobal);
+            }
+
+            for (auto *child : parent->m_children) {
+                if (child->m_active) {
+                    child->m_cachedParentTransform = parentGlobal;
+                    stack.push_back(child);
+                }
+            }
+        }
+    }
+}
+
+// Runs a propagation pass and, if events is given, enqueues a single
+// TransformsChanged event for it. Nothing is enqueued if no node moved.
+template <typename It>
+void propagateTransforms(entt::registry &reg, It first, It last, entt::dispatcher *events = nullptr)
+{
+    if (!events) {
+        collectPropagatedTransforms(reg, first, last, nullptr);
+        return;
+    }
+
+    TransformsChanged changed;
+    collectPropagatedTransforms(reg, first, last, &changed);
+    if (!changed.entities.empty()) {
+        events->enqueue<TransformsChanged>(std::move(changed));
+    }
+}
+
+void propagateTransforms(entt::registry &reg, TransformDirtyQueue &dirty, entt::dispatcher *events = nullptr)
+{
+    const auto entities = dirty.take();
+    propagateTransforms(reg, entities.begin(), entities.end(), events);
+}
+
+// Sets the local transform of the given entity's SceneNode through
+// registry::patch, without touching any other node. The change is thereby
+// visible to observers of SceneNode updates, like
+//
+//   entt::observer moved{reg, entt::collector.update<SceneNode>()};
+//
+// which collect exactly the moved nodes for propagateTransforms.
+void patchTransform(entt::registry &reg, entt::entity e, const Transform &transform)
+{
+    reg.patch<SceneNode>(e, [&](SceneNode &node) { node.m_transform = transform; });
+}
+
+// Propagates the transforms of all entities collected by the given observer
+// and clears it.
+void propagateTransforms(entt::registry &reg, entt::observer &moved, entt::dispatcher *events = nullptr)
+{
+    propagateTransforms(reg, moved.begin(), moved.end(), events);
+    moved.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Handle to an entity with a SceneNode, for tight loops which touch the node and
+// a few other components of the same entities over and over.
+//
+// The SceneNode pointer is looked up once. The components given as template
+// arguments are accessed through views created along with the handle; these
+// keep their storage pointers, so get() costs a single sparse set lookup
+// instead of a trip through the registry's pool table. Handles to parents and
+// children share these views and need no lookup at all.
+template <typename... Component>
+class SceneHandle : public entt::handle
+{
+  public:
+    SceneHandle() = default;
+
+    SceneHandle(entt::registry &reg, entt::entity e)
+        : entt::handle(reg, e), m_node(&reg.get<SceneNode>(e)), m_views(reg.view<Component>()...)
+    {
+    }
+
+    SceneNode &node() const { return *m_node; }
+
+    SceneNode *operator->() const { return m_node; }
+
+    // Returns the given component, through the cached view if it is one of
+    // the handle's component types and through the registry otherwise.
+    template <typename Type>
+    decltype(auto) get() const
+    {
+        if constexpr ((std::is_same_v<Type, Component> || ...)) {
+            return std::get<View<Type>>(m_views).template get<Type>(entity());
+        } else {
+            return entt::handle::get<Type>();
+        }
+    }
+
+    // Returns an invalid handle for roots.
+    SceneHandle parent() const { return m_node->parent() ? SceneHandle(*this, m_node->parent()) : SceneHandle(); }
+
+    SceneHandle child(std::size_t index) const { return SceneHandle(*this, m_node->children()[index]); }
+
+  private:
+    template <typename Type>
+    using View = decltype(std::declval<entt::registry &>().view<Type>());
+
+    SceneNode *m_node = nullptr;
+    std::tuple<View<Component>...> m_views;
+
+    SceneHandle(const SceneHandle &other, SceneNode *node)
+        : entt::handle(*other.registry(), node->entity()), m_node(node), m_views(other.m_views)
+    {
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Returns the group owning GlobalTransform and HierarchyOrder. After
+// updateTransformGroup, iterating it visits parents before their children, so
+// renderers and physics can consume global transforms as tightly packed arrays
+// without touching any SceneNode.
+auto transformGroup(entt::registry &reg) { return reg.group<GlobalTransform, HierarchyOrder>(); }
+
+// How updateTransformGroup restored the parent-first order.
+enum class TransformGroupSort { None, Insertion, Full };
+
+// Gives every active SceneNode a GlobalTransform and HierarchyOrder, fills them
+// in and sorts the transform group parent-first. Inactive nodes are dropped
+// from the group.
+//
+// Between frames the order usually changes only a little. Hence the group is
+// checked first: if it is still in order, nothing is sorted, and if nodes are
+// on average at most the given number of places away from their sorted
+// position, an insertion sort repairs it in close to linear time. Only heavier
+// churn falls back to a full sort. The summed displacement is within a factor
+// of two of the number of inversions, i.e. of the shifts an insertion sort
+// makes, so moving a large block, e.g. a root's subtree, counts as heavy even
+// though it leaves only a few neighbors out of order.
+TransformGroupSort updateTransformGroup(entt::registry &reg, float insertionSortThreshold = 2.0f)
+{
+    auto group = transformGroup(reg);
+
+    std::uint32_t index = 0;
+    reg.ctx<SceneGraph>().forEachNode([&](const SceneNode &node) {
+        const auto e = node.entity();
+        reg.get_or_emplace<GlobalTransform>(e).value = node.globalTransform();
+        reg.get_or_emplace<HierarchyOrder>(e) = {node.depth(), index++};
+    });
+
+    // Every visited node is part of the group, so anything beyond that was
+    // deactivated since the last update.
+    if (group.size() > index) {
+        std::vector<entt::entity> inactive;
+        for (const auto e : group) {
+            if (!reg.get<SceneNode>(e).activeInHierarchy()) {
+                inactive.push_back(e);
+            }
+        }
+        reg.remove<GlobalTransform, HierarchyOrder>(inactive.begin(), inactive.end());
+    }
+
+    // Indices are dense, so each node's sorted position is its index.
+    std::uint64_t displacement = 0;
+    std::uint32_t position = 0;
+    group.each([&](const GlobalTransform &, const HierarchyOrder &order) {
+        displacement += order.index < position ? position - order.index : order.index - position;
+        ++position;
+    });
+
+    auto compare = [](const HierarchyOrder &lhs, const HierarchyOrder &rhs) { return lhs.index < rhs.index; };
+    if (displacement == 0) {
+        return TransformGroupSort::None;
+    } else if (double(displacement) <= double(insertionSortThreshold) * double(group.size())) {
+        group.sort<HierarchyOrder>(compare, entt::insertion_sort{});
+        return TransformGroupSort::Insertion;
+    } else {
+        group.sort<HierarchyOrder>(compare);
+        return TransformGroupSort::Full;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Triple-buffered store of global transforms for handing frames from the
+// simulation thread to a render thread.
+//
+// The writer fills a back buffer directly from the registry and publishes it
+// with a single atomic store. Readers pin the front buffer while reading, which
+// keeps the writer from reusing it. No locks are taken and no snapshot copy of
+// the scene is made. With three buffers, a reader holding one frame for as long
+// as it likes still leaves the writer a free buffer. The writer only waits if
+// readers pin both older frames at once, i.e. if a frame is held across a
+// publish while the next one is read.
+class GlobalTransformBuffer
+{
+    struct Slot {
+        entt::entity entity = entt::null;
+        Transform transform;
+    };
+
+    struct Buffer {
+        std::uint64_t frame = 0;
+        std::vector<entt::entity> entities;
+        std::vector<Slot> slots; // indexed by entity id
+    };
+
+  public:
+    // A pinned, read-only view of the most recently published frame.
+    class Reader
+    {
+      public:
+        Reader(Reader &&other) : m_owner(std::exchange(other.m_owner, nullptr)), m_index(other.m_index) {}
+
+        ~Reader()
+        {
+            if (m_owner) {
+                m_owner->m_readers[m_index].fetch_sub(1);
+            }
+        }
+
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+        Reader &operator=(Reader &&) = delete;
+
+        std::uint64_t frame() const { return buffer().frame; }
+
+        const std::vector<entt::entity> &entities() const { return buffer().entities; }
+
+        // Returns nullptr if the entity had no SceneNode in this frame.
+        const Transform *find(entt::entity e) const
+        {
+            const auto id = entt::entt_traits<entt::entity>::to_entity(e);
+            const auto &slots = buffer().slots;
+            return id < slots.size() && slots[id].entity == e ? &slots[id].transform : nullptr;
+        }
+
+      private:
+        Reader(const GlobalTransformBuffer *owner, int index) : m_owner(owner), m_index(index) {}
+
+        const Buffer &buffer() const { return m_owner->m_buffers[m_index]; }
+
+        const GlobalTransformBuffer *m_owner;
+        int m_index;
+
+        friend class GlobalTransformBuffer;
+    };
+
+    // Pins the front buffer. Never blocks; retries only if a publish raced us.
+    Reader read() const
+    {
+        for (;;) {
+            const int index = m_front.load();
+            m_readers[index].fetch_add(1);
+
+            // The writer may have swapped in between and started refilling
+            // this buffer, in which case we back off and pin the new front.
+            if (m_front.load() == index) {
+                return Reader(this, index);
+            }
+
+            m_readers[index].fetch_sub(1);
+        }
+    }
+
+    // Fills a back buffer with the global transforms of all active
+    // SceneNodes. Must only be called from the writer thread.
+    void write(const entt::registry &reg)
+    {
+        const int front = m_front.load();
+
+        // Readers which pinned a buffer before an earlier publish must be done
+        // with it before we overwrite it, so pick one nobody holds.
+        m_back = -1;
+        while (m_back == -1) {
+            for (int i = 0; i < bufferCount && m_back == -1; ++i) {
+                if (i != front && m_readers[i].load() == 0) {
+                    m_back = i;
+                }
+            }
+            if (m_back == -1) {
+                std::this_thread::yield();
+            }
+        }
+
+        auto &buffer = m_buffers[m_back];
+        for (const auto e : buffer.entities) {
+            buffer.slots[entt::entt_traits<entt::entity>::to_entity(e)].entity = entt::null;
+        }
+        buffer.entities.clear();
+
+        reg.ctx<const SceneGraph>().forEachNode([&](const SceneNode &node) {
+            const auto e = node.entity();
+            const auto id = entt::entt_traits<entt::entity>::to_entity(e);
+            if (id >= buffer.slots.size()) {
+                buffer.slots.resize(id + 1);
+            }
+
+            buffer.slots[id] = {e, node.globalTransform()};
+            buffer.entities.push_back(e);
+        });
+
+        buffer.frame = m_buffers[front].frame + 1;
+    }
+
+    // Makes the last written buffer visible to readers.
+    void publish() { m_front.store(m_back); }
+
+  private:
+    static constexpr int bufferCount = 3;
+
+    Buffer m_buffers[bufferCount];
+    std::atomic<int> m_front{0};
+    int m_back = 0;
+    mutable std::atomic<int> m_readers[bufferCount] = {0, 0, 0};
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Distributes root subtrees over a fixed number of partitions, typically one
+// per worker thread, and keeps each root in its partition across frames so the
+// nodes stay hot in the same core's cache.
+//
+// Every partition exposes a parent-first list of all nodes in its subtrees.
+// Since subtrees never span partitions, the lists can be processed in parallel
+// without synchronization.
+class ScenePartitioner
+{
+  public:
+    explicit ScenePartitioner(std::size_t partitionCount) : m_nodes(std::max<std::size_t>(partitionCount, 1)) {}
+
+    std::size_t partitionCount() const { return m_nodes.size(); }
+
+    const std::vector<SceneNode *> &nodes(std::size_t partition) const { return m_nodes[partition]; }
+
+    // Returns the partition owning the given root, or partitionCount() if the
+    // entity is not a known root.
+    std::size_t partitionOf(entt::entity root) const
+    {
+        auto it = std::find_if(m_roots.cbegin(), m_roots.cend(), [&](const Root &r) { return r.entity == root; });
+        return it != m_roots.cend() ? it->partition : partitionCount();
+    }
+
+    // Drops roots which were destroyed, deactivated or got a parent, assigns
+    // new roots to the least loaded partition and rebuilds all node lists of
+    // active nodes. Roots which are already known keep their partition.
+    void update(entt::registry &reg)
+    {
+        auto isRoot = [&](entt::entity e) {
+            const auto *node = reg.valid(e) ? reg.try_get<SceneNode>(e) : nullptr;
+            return node && !node->parent() && node->active();
+        };
+
+        m_roots.erase(std::remove_if(m_roots.begin(), m_roots.end(), [&](const Root &r) { return !isRoot(r.entity); }),
+                      m_roots.end());
+
+        std::vector<entt::entity> known;
+        std::vector<std::size_t> loads(partitionCount());
+        for (auto &root : m_roots) {
+            root.size = subtreeSize(reg.get<SceneNode>(root.entity));
+            loads[root.partition] += root.size;
+            known.push_back(root.entity);
+        }
+        std::sort(known.begin(), known.end());
+
+        const auto &graph = reg.ctx<SceneGraph>();
+        for (std::size_t i = 0; i < graph.activeRootCount(); ++i) {
+            const auto *node = graph.roots()[i];
+            if (std::binary_search(known.begin(), known.end(), node->entity())) {
+                continue;
+            }
+
+            const auto partition = std::min_element(loads.begin(), loads.end()) - loads.begin();
+            m_roots.push_back({node->entity(), std::size_t(partition), 0, subtreeSize(*node)});
+            loads[partition] += m_roots.back().size;
+        }
+
+        for (auto &nodes : m_nodes) {
+            nodes.clear();
+        }
+
+        for (auto &root : m_roots) {
+            auto &nodes = m_nodes[root.partition];
+            root.offset = nodes.size();
+
+            nodes.push_back(&reg.get<SceneNode>(root.entity));
+            for (std::size_t i = root.offset; i < nodes.size(); ++i) {
+                for (auto *child : nodes[i]->children()) {
+                    if (child->active()) {
+                        nodes.push_back(child);
+                    }
+                }
+            }
+        }
+    }
+
+    // Moves roots away from partitions whose node count exceeds the average by
+    // more than the given tolerance. Only as few roots as necessary are moved;
+    // everything else stays where it is. Returns the number of moved roots.
+    std::size_t rebalance(float tolerance = 0.25f)
+    {
+        std::vector<std::size_t> loads(partitionCount());
+        std::size_t total = 0;
+        for (const auto &root : m_roots) {
+            loads[root.partition] += root.size;
+            total += root.size;
+        }
+
+        const auto limit = float(total) / float(partitionCount()) * (1 + tolerance);
+
+        std::vector<std::size_t> targets(m_roots.size());
+        std::transform(m_roots.cbegin(), m_roots.cend(), targets.begin(), [](const Root &r) { return r.partition; });
+
+        std::size_t moved = 0;
+        for (std::size_t attempt = 0; attempt < m_roots.size(); ++attempt) {
+            const auto heaviest = std::size_t(std::max_element(loads.begin(), loads.end()) - loads.begin());
+            const auto lightest = std::size_t(std::min_element(loads.begin(), loads.end()) - loads.begin());
+            if (float(loads[heaviest]) <= limit) {
+                break;
+            }
+
+            // Moving a root of half the load difference evens out both
+            // partitions, anything smaller than the difference still helps.
+            const auto gap = loads[heaviest] - loads[lightest];
+            std::size_t best = m_roots.size();
+            for (std::size_t i = 0; i < m_roots.size(); ++i) {
+                if (targets[i] != heaviest || m_roots[i].size >= gap) {
+                    continue;
+                }
+
+                auto distance = [&](std::size_t j) { return std::abs(float(m_roots[j].size) - float(gap) / 2); };
+                if (best == m_roots.size() || distance(i) < distance(best)) {
+                    best = i;
+                }
+            }
+
+            if (best == m_roots.size()) {
+                break;
+            }
+
+            targets[best] = lightest;
+            loads[heaviest] -= m_roots[best].size;
+            loads[lightest] += m_roots[best].size;
+            ++moved;
+        }
+
+        if (moved) {
+            regroup(targets);
+        }
+
+        return moved;
+    }
+
+  private:
+    struct Root {
+        entt::entity entity;
+        std::size_t partition;
+        std::size_t offset; // of the subtree within the partition's node list
+        std::size_t size;
+    };
+
+    std::vector<Root> m_roots;
+    std::vector<std::vector<SceneNode *>> m_nodes;
+
+    // Counts the active nodes of a subtree.
+    static std::size_t subtreeSize(const SceneNode &node)
+    {
+        std::size_t size = 1;
+        for (const auto *child : node.children()) {
+            size += child->active() ? subtreeSize(*child) : 0;
+        }
+        return size;
+    }
+
+    // Moves the subtree segments of all roots into the node lists of their
+    // target partitions.
+    void regroup(const std::vector<std::size_t> &targets)
+    {
+        std::vector<std::vector<SceneNode *>> nodes(partitionCount());
+
+        for (std::size_t i = 0; i < m_roots.size(); ++i) {
+            auto &root = m_roots[i];
+            const auto first = m_nodes[root.partition].cbegin() + std::ptrdiff_t(root.offset);
+
+            root.partition = targets[i];
+            root.offset = nodes[root.partition].size();
+            nodes[root.partition].insert(nodes[root.partition].end(), first, first + std::ptrdiff_t(root.size));
+        }
+
+        m_nodes = std::move(nodes);
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Appends trivially copyable values to a byte buffer, in native byte order.
+class ByteWriter
+{
+  public:
+    explicit ByteWriter(std::vector<char> &out) : m_out(out) {}
+
+    template <typename Type>
+    void write(const Type &value)
+    {
+        static_assert(std::is_trivially_copyable_v<Type>);
+        const auto *bytes = reinterpret_cast<const char *>(&value);
+        m_out.insert(m_out.end(), bytes, bytes + sizeof(Type));
+    }
+
+  private:
+    std::vector<char> &m_out;
+};
+
+// Reads values written by ByteWriter back from a byte buffer. Reading past
+// the end yields value-initialized values and marks the reader as failed, so
+// untrusted buffers can be read without checking every single read.
+class ByteReader
+{
+  public:
+    ByteReader(const char *data, std::size_t size) : m_data(data), m_size(size) {}
+
+    template <typename Type>
+    bool read(Type &value)
+    {
+        static_assert(std::is_trivially_copyable_v<Type>);
+        if (m_failed || sizeof(Type) > remaining()) {
+            m_failed = true;
+            value = Type{};
+            return false;
+        }
+        std::memcpy(&value, m_data + m_position, sizeof(Type));
+        m_position += sizeof(Type);
+        return true;
+    }
+
+    template <typename Type>
+    Type read()
+    {
+        Type value;
+        read(value);
+        return value;
+    }
+
+    bool exhausted() const { return m_position == m_size; }
+
+    bool failed() const { return m_failed; }
+
+    std::size_t remaining() const { return m_size - m_position; }
+
+  private:
+    const char *m_data;
+    std::size_t m_size;
+    std::size_t m_position = 0;
+    bool m_failed = false;
+};
+
+// Output archive for entt::basic_snapshot, writing a compact binary stream to a
+// byte buffer. A SceneNode is stored as its entity, its parent's entity, its
+// local transform and its active flag; the pointers are not stored.
+class SceneOutputArchive
+{
+  public:
+    explicit SceneOutputArchive(std::vector<char> &out) : m_out(out) {}
+
+    void operator()(std::uint32_t value) { write(value); }
+
+    void operator()(entt::entity e) { write(e); }
+
+    void operator()(entt::entity e, const SceneNode &node)
+    {
+        write(e);
+        write(node.parent() ? node.parent()->entity() : entt::entity(entt::null));
+        write(node.transform());
+        write(std::uint8_t(node.active()));
+    }
+
+  private:
+    ByteWriter m_out;
+
+    template <typename Type>
+    void write(const Type &value)
+    {
+        m_out.write(value);
+    }
+};
+
+// Input archive for entt::basic_snapshot_loader and
+// entt::basic_continuous_loader, reading what SceneOutputArchive wrote.
+// SceneNodes are restored without links; the parent of each is recorded in
+// links() instead, to be passed to linkSceneNodes once all nodes exist.
+class SceneInputArchive
+{
+  public:
+    SceneInputArchive(const char *data, std::size_t size) : m_in(data, size) {}
+
+    explicit SceneInputArchive(const std::vector<char> &in) : SceneInputArchive(in.data(), in.size()) {}
+
+    void operator()(std::uint32_t &value) { read(value); }
+
+    void operator()(entt::entity &e) { read(e); }
+
+    void operator()(entt::entity &e, SceneNode &node)
+    {
+        entt::entity parent;
+        Transform transform;
+        std::uint8_t active;
+
+        read(e);
+        read(parent);
+        read(transform);
+        read(active);
+
+        node = SceneNode{};
+        node.setTransform(transform);
+        node.setActive(active);
+        m_links.emplace_back(e, parent);
+    }
+
+    // Pairs of child and parent entities, as stored in the archive.
+    const std::vector<std::pair<entt::entity, entt::entity>> &links() const { return m_links; }
+
+    std::vector<std::pair<entt::entity, entt::entity>> &links() { return m_links; }
+
+    bool exhausted() const { return m_in.exhausted(); }
+
+  private:
+    ByteReader m_in;
+
+    std::vector<std::pair<entt::entity, entt::entity>> m_links;
+
+    template <typename Type>
+    void read(Type &value)
+    {
+        if (!m_in.read(value)) {
+            assert(false && "Truncated scene archive");
+        }
+    }
+};
+
+// Restores the hierarchy of freshly loaded SceneNodes from pairs of child and
+// parent entities in one linear pass. Children keep the order in which they
+// appear. Pairs with a null parent denote roots.
+void linkSceneNodes(entt::registry &reg, const std::vector<std::pair<entt::entity, entt::entity>> &links)
+{
+    for (const auto &[child, parent] : links) {
+        if (parent != entt::null) {
+            reg.get<SceneNode>(parent).addFreshChild(&reg.get<SceneNode>(child));
+        }
+    }
+}
+
+// Appends the entities of the subtree rooted at root parent-first with
+// siblings in order, so linkSceneNodes reproduces the children lists exactly.
+// The walk follows the children pointers, without registry lookups.
+void appendSubtreeOrder(const SceneNode &root, std::vector<entt::entity> &order)
+{
+    std::vector<const SceneNode *> queue = {&root};
+    for (std::size_t i = 0; i < queue.size(); ++i) {
+        order.push_back(queue[i]->entity());
+        queue.insert(queue.end(), queue[i]->children().begin(), queue[i]->children().end());
+    }
+}
+
+// Writes all entities and SceneNodes of the registry to a byte buffer.
+//
+// As SceneNode uses in_place_delete, its pool may hold tombstones after
+// churn. Nodes are therefore gathered from the roots of the SceneGraph, if
+// the registry has one, instead of scanning the pool, so dead slots are
+// neither visited nor written. Loading into an empty registry then yields a
+// pool without holes. Views iterate a pool from its back, so the nodes are
+// written in reverse hierarchy order, which makes views of the loaded
+// registry visit parents before their children.
+std::vector<char> saveScene(const entt::registry &reg)
+{
+    std::vector<entt::entity> order;
+    if (const auto *graph = reg.try_ctx<const SceneGraph>()) {
+        order.reserve(graph->nodeCount());
+        for (const auto *root : graph->roots()) {
+            appendSubtreeOrder(*root, order);
+        }
+    } else {
+        for (auto [e, node] : reg.view<const SceneNode>().each()) {
+            if (!node.parent()) {
+                appendSubtreeOrder(node, order);
+            }
+        }
+    }
+    std::reverse(order.begin(), order.end());
+
+    std::vector<char> bytes;
+    SceneOutputArchive archive(bytes);
+    entt::snapshot{reg}.entities(archive).component<SceneNode>(archive, order.begin(), order.end());
+    return bytes;
+}
+
+// Restores a scene written by saveScene into an empty registry, keeping the
+// original entity identifiers. SceneNodes end up packed in the stored order,
+// so views of the SceneNode pool visit parents first.
+void loadScene(entt::registry &reg, const std::vector<char> &bytes)
+{
+    SceneInputArchive archive(bytes);
+    entt::snapshot_loader{reg}.entities(archive).component<SceneNode>(archive);
+
+    // Nodes are stored leaves first, links are made parents first.
+    auto &links = archive.links();
+    std::reverse(links.begin(), links.end());
+    linkSceneNodes(reg, links);
+}
+
+// Writes the SceneNodes of the subtree rooted at root to a byte buffer, for
+// streaming with loadSubtree. Entities outside the subtree are not written.
+std::vector<char> saveSubtree(const entt::registry &reg, entt::entity root)
+{
+    std::vector<entt::entity> order;
+    appendSubtreeOrder(reg.get<SceneNode>(root), order);
+
+    std::vector<char> bytes;
+    SceneOutputArchive archive(bytes);
+    entt::snapshot{reg}.component<SceneNode>(archive, order.begin(), order.end());
+    return bytes;
+}
+
+// Appends a subtree written by saveSubtree to a live registry, creating fresh
+// entities for the stored ones, and attaches it to attachTo if given. Links
+// are remapped to the new entities; the stored root's parent is not part of
+// the subtree and maps to attachTo. A continuous loader is used per call, as
+// it strips components from every entity it loaded before, so nodes outside
+// the incoming subtree are left untouched. Returns the new entities in
+// stream order, the subtree root first.
+std::vector<entt::entity> loadSubtree(entt::registry &reg, const std::vector<char> &bytes,
+                                      SceneNode *attachTo = nullptr)
+{
+    SceneInputArchive archive(bytes);
+    entt::continuous_loader loader{reg};
+    loader.component<SceneNode>(archive);
+
+    const auto attachEntity = attachTo ? attachTo->entity() : entt::entity(entt::null);
+
+    std::vector<entt::entity> entities;
+    entities.reserve(archive.links().size());
+    for (auto &[child, parent] : archive.links()) {
+        child = loader.map(child);
+        parent = loader.contains(parent) ? loader.map(parent) : attachEntity;
+        entities.push_back(child);
+    }
+
+    linkSceneNodes(reg, archive.links());
+    return entities;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Header of a flat scene file. It is followed by the parent index and
+// transform arrays of a FlatScene, each starting at an aligned offset, so a
+// mapped file can be read in place. Values are stored in native byte order.
+//
+// With the quantizedPositions flag, the transform section instead starts with
+// a QuantizedPositions header, followed by the bit-packed positions, see
+// writeFlatSceneFile. If activeOffset is not zero, it points to one byte per
+// node holding the node's active flag; otherwise all nodes are active.
+struct FlatSceneFileHeader {
+    static constexpr char expectedMagic[4] = {'E', 'S', 'G', 'F'};
+    static constexpr std::uint32_t currentVersion = 3;
+    static constexpr std::uint64_t sectionAlignment = 64;
+
+    static constexpr std::uint32_t quantizedPositions = 1;
+
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t nodeCount;
+    std::uint32_t flags;
+    std::uint64_t parentsOffset;
+    std::uint64_t transformsOffset;
+    std::uint64_t activeOffset;
+};
+
+// Header of a quantized transform section. A position is origin + q * step,
+// per axis, where the q values of each axis take their own number of bits.
+// Each axis, x, y and z in turn, is stored as a stream of 32 bit words split
+// into four interleaved lanes: node i goes to lane i % 4, and word k of lane l
+// is word 4 * k + l of the stream. Each lane packs its q values lowest bits
+// first and ends with a padding word. This way one SSE2 register holds the
+// same bits of four consecutive nodes, which are cut out with shifts shared by
+// all lanes.
+struct QuantizedPositions {
+    static constexpr std::uint32_t maxBits = 16;
+    static constexpr std::uint64_t lanes = 4;
+
+    Vec3 origin;
+    Vec3 step;
+    std::uint32_t bits[3];
+    std::uint32_t padding;
+
+    // Number of words of an axis stream, including the padding words.
+    static std::uint64_t streamWords(std::uint64_t nodeCount, std::uint32_t bits)
+    {
+        const auto perLane = (nodeCount + lanes - 1) / lanes;
+        return ((perLane * bits + 31) / 32 + 1) * lanes;
+    }
+
+    // Size of the section, including this header.
+    static std::uint64_t sectionSize(std::uint64_t nodeCount, const std::uint32_t (&bits)[3])
+    {
+        const auto words = streamWords(nodeCount, bits[0]) + streamWords(nodeCount, bits[1])
+            + streamWords(nodeCount, bits[2]);
+        return sizeof(QuantizedPositions) + words * sizeof(std::uint32_t);
+    }
+};
+
+// Bits per axis of quantized positions, see writeFlatSceneFile.
+struct PositionBits {
+    std::uint32_t x = 0;
+    std::uint32_t y = 0;
+    std::uint32_t z = 0;
+
+    PositionBits(std::uint32_t bits = 0) : x(bits), y(bits), z(bits) {}
+    PositionBits(std::uint32_t x, std::uint32_t y, std::uint32_t z) : x(x), y(y), z(z) {}
+
+    bool quantized() const
+    {
+        const auto valid = [](std::uint32_t bits) { return bits >= 1 && bits <= QuantizedPositions::maxBits; };
+        return valid(x) && valid(y) && valid(z);
+    }
+};
+
+// Serializes the given FlatScene into the flat scene file format. If the
+// position bits of every axis are between 1 and 16, positions are quantized to
+// that many bits over the bounds of all local positions and bit-packed,
+// otherwise they are stored as floats. The precision of each axis is stored
+// with the transform section.
+std::vector<char> writeFlatSceneFile(const FlatSceneView &scene, PositionBits positionBits = {})
+{
+    const auto align = [](std::uint64_t offset) {
+        const auto alignment = FlatSceneFileHeader::sectionAlignment;
+        return (offset + alignment - 1) / alignment * alignment;
+    };
+
+    const bool quantize = positionBits.quantized();
+    const std::uint32_t bits[3] = {positionBits.x, positionBits.y, positionBits.z};
+    const auto transformsSize = quantize ? QuantizedPositions::sectionSize(scene.size(), bits)
+                                         : scene.size() * sizeof(Transform);
+
+    FlatSceneFileHeader header{};
+    std::memcpy(header.magic, FlatSceneFileHeader::expectedMagic, sizeof(header.magic));
+    header.version = FlatSceneFileHeader::currentVersion;
+    header.nodeCount = std::uint32_t(scene.size());
+    header.flags = quantize ? FlatSceneFileHeader::quantizedPositions : 0;
+    header.parentsOffset = align(sizeof(header));
+    header.transformsOffset = align(header.parentsOffset + scene.size() * sizeof(std::uint32_t));
+
+    const bool allActive = !scene.active || std::all_of(scene.active, scene.active + scene.size(), [](auto a) {
+        return a != 0;
+    });
+    header.activeOffset = allActive ? 0 : align(header.transformsOffset + transformsSize);
+
+    std::vector<char> bytes(allActive ? header.transformsOffset + transformsSize : header.activeOffset + scene.size());
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    std::memcpy(bytes.data() + header.parentsOffset, scene.parents, scene.size() * sizeof(std::uint32_t));
+    if (!allActive) {
+        std::memcpy(bytes.data() + header.activeOffset, scene.active, scene.size());
+    }
+
+    if (!quantize) {
+        std::memcpy(bytes.data() + header.transformsOffset, scene.transforms, scene.size() * sizeof(Transform));
+        return bytes;
+    }
+
+    Vec3 low = scene.size() ? scene.transforms[0].position : Vec3::zero;
+    Vec3 high = low;
+    for (std::size_t i = 0; i < scene.size(); ++i) {
+        const auto &p = scene.transforms[i].position;
+        low = {std::min(low.x, p.x), std::min(low.y, p.y), std::min(low.z, p.z)};
+        high = {std::max(high.x, p.x), std::max(high.y, p.y), std::max(high.z, p.z)};
+    }
+
+    const auto levels = [&](int axis) { return float((1u << bits[axis]) - 1); };
+    QuantizedPositions grid{};
+    grid.origin = low;
+    grid.step = {(high.x - low.x) / levels(0), (high.y - low.y) / levels(1), (high.z - low.z) / levels(2)};
+    std::copy_n(bits, 3, grid.bits);
+    std::memcpy(bytes.data() + header.transformsOffset, &grid, sizeof(grid));
+
+    const auto quantizeAxis = [](float value, float origin, float step) {
+        return std::uint64_t(step > 0 ? std::lround((value - origin) / step) : 0);
+    };
+
+    const float origin[3] = {grid.origin.x, grid.origin.y, grid.origin.z};
+    const float step[3] = {grid.step.x, grid.step.y, grid.step.z};
+
+    auto *stream = bytes.data() + header.transformsOffset + sizeof(grid);
+    for (int axis = 0; axis < 3; ++axis) {
+        std::vector<std::uint32_t> words(QuantizedPositions::streamWords(scene.size(), bits[axis]));
+        for (std::size_t i = 0; i < scene.size(); ++i) {
+            const auto &p = scene.transforms[i].position;
+            const float value[3] = {p.x, p.y, p.z};
+
+            const auto lane = i % QuantizedPositions::lanes;
+            const auto bit = i / QuantizedPositions::lanes * bits[axis];
+            const auto word = bit / 32 * QuantizedPositions::lanes + lane;
+            const auto q = quantizeAxis(value[axis], origin[axis], step[axis]) << (bit % 32);
+            words[word] |= std::uint32_t(q);
+            words[word + QuantizedPositions::lanes] |= std::uint32_t(q >> 32);
+        }
+        std::memcpy(stream, words.data(), words.size() * sizeof(std::uint32_t));
+        stream += words.size() * sizeof(std::uint32_t);
+    }
+    return bytes;
+}
+
+// Validates the header of a flat scene file and the bounds of its sections.
+std::optional<FlatSceneFileHeader> readFlatSceneFileHeader(const char *data, std::size_t size)
+{
+    FlatSceneFileHeader header;
+    if (size < sizeof(header)) {
+        return std::nullopt;
+    }
+    std::memcpy(&header, data, sizeof(header));
+
+    if (std::memcmp(header.magic, FlatSceneFileHeader::expectedMagic, sizeof(header.magic)) != 0
+        || header.version != FlatSceneFileHeader::currentVersion
+        || (header.flags & ~FlatSceneFileHeader::quantizedPositions) != 0) {
+        return std::nullopt;
+    }
+
+    const bool quantized = header.flags & FlatSceneFileHeader::quantizedPositions;
+    std::uint64_t transformsSize = header.nodeCount * sizeof(Transform);
+    if (quantized) {
+        QuantizedPositions grid;
+        if (header.transformsOffset > size || sizeof(grid) > size - header.transformsOffset) {
+            return std::nullopt;
+        }
+        std::memcpy(&grid, data + header.transformsOffset, sizeof(grid));
+        if (!PositionBits(grid.bits[0], grid.bits[1], grid.bits[2]).quantized()) {
+            return std::nullopt;
+        }
+        transformsSize = QuantizedPositions::sectionSize(header.nodeCount, grid.bits);
+    }
+
+    // Offsets come from the file, so they are compared without additions that
+    // could wrap around.
+    const auto fits = [size](std::uint64_t offset, std::uint64_t length) {
+        return offset <= size && length <= size - offset;
+    };
+
+    const auto parentsSize = std::uint64_t(header.nodeCount) * sizeof(std::uint32_t);
+    if (header.parentsOffset < sizeof(header) || header.parentsOffset > header.transformsOffset
+        || parentsSize > header.transformsOffset - header.parentsOffset
+        || !fits(header.parentsOffset, parentsSize) || !fits(header.transformsOffset, transformsSize)
+        || header.parentsOffset % alignof(std::uint32_t) != 0 || header.transformsOffset % alignof(Transform) != 0
+        || reinterpret_cast<std::uintptr_t>(data) % alignof(Transform) != 0) {
+        return std::nullopt;
+    }
+
+    if (header.activeOffset != 0
+        && (header.activeOffset < header.transformsOffset
+            || transformsSize > header.activeOffset - header.transformsOffset
+            || !fits(header.activeOffset, header.nodeCount))) {
+        return std::nullopt;
+    }
+
+    const auto *parents = reinterpret_cast<const std::uint32_t *>(data + header.parentsOffset);
+    for (std::size_t i = 0; i < header.nodeCount; ++i) {
+        if (parents[i] != FlatScene::noParent && parents[i] >= i) {
+            return std::nullopt;
+        }
+    }
+
+    return header;
+}
+
+// Validates a flat scene file held in memory and returns a view of its
+// arrays, pointing into the given bytes. These have to be aligned to the
+// section alignment, as mapped files and heap buffers are. Returns nothing if
+// the data is not a flat scene file of the current version, or if its
+// positions are quantized, as those have to be decoded by decodeFlatSceneFile.
+std::optional<FlatSceneView> readFlatSceneFile(const char *data, std::size_t size)
+{
+    const auto header = readFlatSceneFileHeader(data, size);
+    if (!header || header->flags & FlatSceneFileHeader::quantizedPositions) {
+        return std::nullopt;
+    }
+
+    FlatSceneView scene;
+    scene.parents = reinterpret_cast<const std::uint32_t *>(data + header->parentsOffset);
+    scene.transforms = reinterpret_cast<const Transform *>(data + header->transformsOffset);
+    scene.count = header->nodeCount;
+    if (header->activeOffset) {
+        scene.active = reinterpret_cast<const std::uint8_t *>(data + header->activeOffset);
+    }
+    return scene;
+}
+
+// Decodes a flat scene file of either mode into the given FlatScene. Returns
+// false if the data is not a flat scene file of the current version.
+bool decodeFlatSceneFile(const char *data, std::size_t size, FlatScene &out)
+{
+    const auto header = readFlatSceneFileHeader(data, size);
+    if (!header) {
+        return false;
+    }
+
+    const auto *parents = reinterpret_cast<const std::uint32_t *>(data + header->parentsOffset);
+    out.entities.clear();
+    out.parents.assign(parents, parents + header->nodeCount);
+    out.transforms.resize(header->nodeCount);
+    out.active.clear();
+    if (header->activeOffset) {
+        const auto *active = reinterpret_cast<const std::uint8_t *>(data + header->activeOffset);
+        out.active.assign(active, active + header->nodeCount);
+    }
+
+    if (!(header->flags & FlatSceneFileHeader::quantizedPositions)) {
+        std::memcpy(out.transforms.data(), data + header->transformsOffset, header->nodeCount * sizeof(Transform));
+        return true;
+    }
+
+    QuantizedPositions grid;
+    std::memcpy(&grid, data + header->transformsOffset, sizeof(grid));
+
+    const char *streams[3];
+    streams[0] = data + header->transformsOffset + sizeof(grid);
+    for (int axis = 1; axis < 3; ++axis) {
+        const auto words = QuantizedPositions::streamWords(header->nodeCount, grid.bits[axis - 1]);
+        streams[axis] = streams[axis - 1] + words * sizeof(std::uint32_t);
+    }
+
+    // Each value is cut from the two words of its lane it may span, without
+    // branches; the padding words make reading the second word always safe.
+    const auto unpack = [&](int axis, std::size_t i) {
+        const auto lane = i % QuantizedPositions::lanes;
+        const auto bit = i / QuantizedPositions::lanes * grid.bits[axis];
+        const auto *word = streams[axis] + (bit / 32 * QuantizedPositions::lanes + lane) * sizeof(std::uint32_t);
+        std::uint32_t pair[2];
+        std::memcpy(&pair[0], word, sizeof(std::uint32_t));
+        std::memcpy(&pair[1], word + QuantizedPositions::lanes * sizeof(std::uint32_t), sizeof(std::uint32_t));
+        const auto value = (pair[0] | std::uint64_t(pair[1]) << 32) >> (bit % 32);
+        return float(value & ((std::uint64_t(1) << grid.bits[axis]) - 1));
+    };
+
+    auto *transforms = out.transforms.data();
+    std::size_t i = 0;
+
+#ifdef __SSE2__
+    // Four nodes at a time: every lane of a stream word belongs to one of
+    // them, at the same bit offset. The four transformed rows are stored
+    // overlapping, each spilling into the next node, so this stops one node
+    // short of the end.
+    static_assert(sizeof(Transform) == 3 * sizeof(float), "Transforms are stored as packed x, y, z floats");
+    const __m128 origin[3] = {_mm_set1_ps(grid.origin.x), _mm_set1_ps(grid.origin.y), _mm_set1_ps(grid.origin.z)};
+    const __m128 step[3] = {_mm_set1_ps(grid.step.x), _mm_set1_ps(grid.step.y), _mm_set1_ps(grid.step.z)};
+    __m128i mask[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        mask[axis] = _mm_set1_epi32(int((1u << grid.bits[axis]) - 1));
+    }
+
+    const auto decodeLanes = [&](int axis, std::size_t group) {
+        const auto bit = group * grid.bits[axis];
+        const auto *word = reinterpret_cast<const __m128i *>(streams[axis]) + bit / 32;
+        const auto low = _mm_srl_epi32(_mm_loadu_si128(word), _mm_cvtsi32_si128(int(bit % 32)));
+        const auto high = _mm_sll_epi32(_mm_loadu_si128(word + 1), _mm_cvtsi32_si128(int(32 - bit % 32)));
+        const auto q = _mm_and_si128(_mm_or_si128(low, high), mask[axis]);
+        return _mm_add_ps(origin[axis], _mm_mul_ps(_mm_cvtepi32_ps(q), step[axis]));
+    };
+
+    for (; i + QuantizedPositions::lanes < header->nodeCount; i += QuantizedPositions::lanes) {
+        const auto group = i / QuantizedPositions::lanes;
+        auto x = decodeLanes(0, group);
+        auto y = decodeLanes(1, group);
+        auto z = decodeLanes(2, group);
+        auto w = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+
+        auto *dst = &transforms[i].position.x;
+        _mm_storeu_ps(dst, x);
+        _mm_storeu_ps(dst + 3, y);
+        _mm_storeu_ps(dst + 6, z);
+        _mm_storeu_ps(dst + 9, w);
+    }
+#endif
+
+    for (; i < header->nodeCount; ++i) {
+        transforms[i].position.x = grid.origin.x + unpack(0, i) * grid.step.x;
+        transforms[i].position.y = grid.origin.y + unpack(1, i) * grid.step.y;
+        transforms[i].position.z = grid.origin.z + unpack(2, i) * grid.step.z;
+    }
+
+    return true;
+}
+
+bool saveFlatSceneFile(const char *path, const FlatSceneView &scene, PositionBits positionBits = {})
+{
+    const auto bytes = writeFlatSceneFile(scene, positionBits);
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), std::streamsize(bytes.size()));
+    return bool(file);
+}
+
+// Read-only memory mapping of a flat scene file. Pages are only read in when
+// the arrays are accessed, so a scene can be instantiated, or its static parts
+// used in place, without parsing the file first.
+class MappedFlatSceneFile
+{
+  public:
+    explicit MappedFlatSceneFile(const char *path)
+    {
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            auto *data = mmap(nullptr, std::size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                m_data = static_cast<const char *>(data);
+                m_size = std::size_t(info.st_size);
+                m_scene = readFlatSceneFile(m_data, m_size);
+            }
+        }
+
+        close(fd);
+    }
+
+    ~MappedFlatSceneFile()
+    {
+        if (m_data) {
+            munmap(const_cast<char *>(m_data), m_size);
+        }
+    }
+
+    MappedFlatSceneFile(const MappedFlatSceneFile &) = delete;
+    MappedFlatSceneFile &operator=(const MappedFlatSceneFile &) = delete;
+
+    // Returns the mapped scene, or nothing if the file could not be mapped or
+    // is not a valid flat scene file.
+    const std::optional<FlatSceneView> &scene() const { return m_scene; }
+
+  private:
+    const char *m_data = nullptr;
+    std::size_t m_size = 0;
+    std::optional<FlatSceneView> m_scene;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Encodes how SceneNode transforms and links changed since a baseline state,
+// for replicating a scene to one client. A delta lists the entities whose
+// SceneNodes were removed, followed by one record per new or changed node
+// holding only the fields that changed.
+//
+// Deltas may be lost or arrive out of order, so each is encoded against the
+// latest state the client acknowledged, the empty scene until then, and
+// carries the sequence numbers of its baseline and of the state it describes.
+// The client reports the sequence of its current state back, see
+// SceneDeltaDecoder::sequence, and the encoder is told with acknowledge. As
+// acknowledgements differ per client, every client needs its own encoder.
+class SceneDeltaEncoder
+{
+  public:
+    static constexpr std::uint8_t transformChanged = 1;
+    static constexpr std::uint8_t parentChanged = 2;
+
+    // Sent states kept for acknowledgements still in flight. Beyond that, the
+    // oldest unacknowledged one is dropped.
+    static constexpr std::size_t maxPendingStates = 64;
+
+    struct NodeState {
+        entt::entity parent;
+        Transform transform;
+    };
+
+    // Replicated nodes by encoder entity.
+    using SceneState = std::unordered_map<entt::entity, NodeState>;
+
+    std::vector<char> encode(const entt::registry &reg)
+    {
+        static const SceneState empty;
+        const auto sequence = m_nextSequence++;
+        const auto &baseline = m_acknowledged ? m_sent.at(m_acknowledged) : empty;
+        auto &state = m_sent[sequence];
+
+        std::vector<char> bytes;
+        ByteWriter out(bytes);
+        out.write(m_acknowledged);
+        out.write(sequence);
+
+        std::vector<std::pair<const SceneNode *, std::uint8_t>> changed;
+        for (auto [e, node] : reg.view<const SceneNode>().each()) {
+            const auto parent = node.parent() ? node.parent()->entity() : entt::entity(entt::null);
+            state.emplace(e, NodeState{parent, node.transform()});
+
+            std::uint8_t fields = transformChanged | parentChanged;
+            if (const auto it = baseline.find(e); it != baseline.end()) {
+                fields = (it->second.transform != node.transform() ? transformChanged : 0)
+                    | (it->second.parent != parent ? parentChanged : 0);
+            }
+            if (fields) {
+                changed.emplace_back(&node, fields);
+            }
+        }
+
+        std::vector<entt::entity> removed;
+        for (const auto &[e, node] : baseline) {
+            if (!state.count(e)) {
+                removed.push_back(e);
+            }
+        }
+
+        out.write(std::uint32_t(removed.size()));
+        for (const auto e : removed) {
+            out.write(e);
+        }
+
+        out.write(std::uint32_t(changed.size()));
+        for (const auto &[node, fields] : changed) {
+            out.write(node->entity());
+            out.write(fields);
+            if (fields & transformChanged) {
+                out.write(node->transform());
+            }
+            if (fields & parentChanged) {
+                out.write(node->parent() ? node->parent()->entity() : entt::entity(entt::null));
+            }
+        }
+
+        if (m_sent.size() > maxPendingStates) {
+            m_sent.erase(m_sent.upper_bound(m_acknowledged));
+        }
+
+        return bytes;
+    }
+
+    // Makes the state of the given sequence, as reported by the client, the
+    // baseline of following deltas. Older and unknown sequences are ignored.
+    void acknowledge(std::uint32_t sequence)
+    {
+        if (sequence > m_acknowledged && m_sent.count(sequence)) {
+            m_acknowledged = sequence;
+            m_sent.erase(m_sent.begin(), m_sent.find(sequence));
+        }
+    }
+
+  private:
+    std::map<std::uint32_t, SceneState> m_sent;
+    std::uint32_t m_acknowledged = 0;
+    std::uint32_t m_nextSequence = 1;
+};
+
+// Applies deltas from a SceneDeltaEncoder to another registry. Nodes seen for
+// the first time get fresh entities, as registries hand out entities
+// independently; map translates the encoder's entities to local ones.
+//
+// The decoder keeps the replicated states it reached, so a delta against an
+// older baseline than its current state still applies: the delta turns the
+// baseline into the target state, and the difference to the current state is
+// what gets applied.
+class SceneDeltaDecoder
+{
+  public:
+    // Applies the given delta. Deltas come from the network, so they are
+    // validated first: if one is truncated or malformed, stale, against an
+    // unknown baseline, links to unknown nodes, or would link nodes into a
+    // cycle, nothing is changed and false is returned.
+    bool apply(entt::registry &reg, const std::vector<char> &delta)
+    {
+        constexpr std::uint8_t knownFields = SceneDeltaEncoder::transformChanged | SceneDeltaEncoder::parentChanged;
+        constexpr std::size_t minRecordSize = sizeof(entt::entity) + sizeof(std::uint8_t);
+
+        ByteReader in(delta.data(), delta.size());
+
+        const auto baselineSequence = in.read<std::uint32_t>();
+        const auto sequence = in.read<std::uint32_t>();
+        if (sequence <= m_sequence || baselineSequence > m_sequence
+            || (baselineSequence && !m_received.count(baselineSequence))) {
+            return false;
+        }
+
+        const auto removedCount = in.read<std::uint32_t>();
+        if (removedCount > in.remaining() / sizeof(entt::entity)) {
+            return false;
+        }
+        std::unordered_set<entt::entity> removed;
+        for (auto i = removedCount; i > 0; --i) {
+            removed.insert(in.read<entt::entity>());
+        }
+
+        const auto recordCount = in.read<std::uint32_t>();
+        if (recordCount > in.remaining() / minRecordSize) {
+            return false;
+        }
+        std::vector<Record> records(recordCount);
+        std::unordered_set<entt::entity> seen;
+        for (auto &record : records) {
+            in.read(record.remote);
+            in.read(record.fields);
+            if (record.fields & SceneDeltaEncoder::transformChanged) {
+                in.read(record.transform);
+            }
+            if (record.fields & SceneDeltaEncoder::parentChanged) {
+                in.read(record.parent);
+            }
+
+            if ((record.fields & ~knownFields) || removed.count(record.remote) || !seen.insert(record.remote).second) {
+                return false;
+            }
+        }
+        if (in.failed() || !in.exhausted()) {
+            return false;
+        }
+
+        // Turn the baseline into the target state; nodes new to it have to
+        // come with all fields.
+        auto target = state(baselineSequence);
+        for (const auto remote : removed) {
+            target.erase(remote);
+        }
+        for (const auto &record : records) {
+            auto it = target.find(record.remote);
+            if (it == target.end()) {
+                if (record.fields != knownFields) {
+                    return false;
+                }
+                it = target.emplace(record.remote, SceneDeltaEncoder::NodeState{}).first;
+            }
+            if (record.fields & SceneDeltaEncoder::transformChanged) {
+                it->second.transform = record.transform;
+            }
+            if (record.fields & SceneDeltaEncoder::parentChanged) {
+                it->second.parent = record.parent;
+            }
+        }
+
+        // Replace the delta by the changes from the current state to the
+        // target, which are the same if the baseline is the current state.
+        const auto &current = state(m_sequence);
+        removed.clear();
+        for (const auto &[remote, node] : current) {
+            if (!target.count(remote)) {
+                removed.insert(remote);
+            }
+        }
+        records.clear();
+        for (const auto &[remote, node] : target) {
+            std::uint8_t fields = knownFields;
+            if (const auto it = current.find(remote); it != current.end()) {
+                fields = (it->second.transform != node.transform ? SceneDeltaEncoder::transformChanged : 0)
+                    | (it->second.parent != node.parent ? SceneDeltaEncoder::parentChanged : 0);
+            }
+            if (fields) {
+                records.push_back({remote, fields, node.transform, node.parent});
+            }
+        }
+
+        std::unordered_map<entt::entity, const Record *> incoming;
+        for (const auto &record : records) {
+            incoming.emplace(record.remote, &record);
+        }
+
+        // Parent of the given encoder node once the delta is applied, or null.
+        // Local nodes in between, which the encoder does not know, are skipped.
+        const auto parentAfterwards = [&](entt::entity remote) -> entt::entity {
+            if (const auto it = incoming.find(remote); it != incoming.end()) {
+                if (it->second->fields & SceneDeltaEncoder::parentChanged) {
+                    return it->second->parent;
+                }
+            }
+            const auto *node = localNode(reg, remote);
+            for (const auto *parent = node ? node->parent() : nullptr; parent; parent = parent->parent()) {
+                if (const auto it = m_remote.find(parent->entity()); it != m_remote.end()) {
+                    return removed.count(it->second) ? entt::entity(entt::null) : it->second;
+                }
+            }
+            return entt::null;
+        };
+
+        const auto maxDepth = m_local.size() + records.size();
+        for (const auto &record : records) {
+            if (!(record.fields & SceneDeltaEncoder::parentChanged) || record.parent == entt::null) {
+                continue;
+            }
+            if (!incoming.count(record.parent) && (removed.count(record.parent) || !localNode(reg, record.parent))) {
+                return false;
+            }
+
+            std::size_t depth = 0;
+            for (auto ancestor = record.parent; ancestor != entt::null; ancestor = parentAfterwards(ancestor)) {
+                if (ancestor == record.remote || ++depth > maxDepth) {
+                    return false;
+                }
+            }
+        }
+
+        for (const auto remote : removed) {
+            if (const auto it = m_local.find(remote); it != m_local.end()) {
+                if (reg.valid(it->second)) {
+                    reg.destroy(it->second);
+                }
+                m_remote.erase(it->second);
+                m_local.erase(it);
+            }
+        }
+
+        // Create all new nodes first, so links to them can be resolved.
+        for (auto &record : records) {
+            record.node = localNode(reg, record.remote);
+            if (!record.node) {
+                const auto local = reg.create();
+                record.node = &reg.emplace<SceneNode>(local);
+                if (const auto it = m_local.find(record.remote); it != m_local.end()) {
+                    m_remote.erase(it->second);
+                }
+                m_local[record.remote] = local;
+                m_remote[local] = record.remote;
+            }
+
+            if (record.fields & SceneDeltaEncoder::transformChanged) {
+                record.node->setTransform(record.transform);
+            }
+        }
+
+        // Detach all re-parented nodes before attaching any, so swapping a
+        // parent and its child never forms a cycle in between.
+        for (const auto &record : records) {
+            if (record.fields & SceneDeltaEncoder::parentChanged) {
+                if (auto *parent = record.node->parent()) {
+                    parent->removeChild(record.node);
+                }
+            }
+        }
+        for (const auto &record : records) {
+            if ((record.fields & SceneDeltaEncoder::parentChanged) && record.parent != entt::null) {
+                localNode(reg, record.parent)->addChild(record.node);
+            }
+        }
+
+        // Later deltas are encoded against this state or a newer one.
+        m_received.erase(m_received.begin(), m_received.lower_bound(baselineSequence));
+        m_received[sequence] = std::move(target);
+        m_sequence = sequence;
+        return true;
+    }
+
+    // Sequence of the current state, to be acknowledged to the encoder.
+    std::uint32_t sequence() const { return m_sequence; }
+
+    // Returns the local entity of the given encoder entity, or null if it is
+    // unknown.
+    entt::entity map(entt::entity remote) const
+    {
+        const auto it = m_local.find(remote);
+        return it != m_local.end() ? it->second : entt::null;
+    }
+
+  private:
+    struct Record {
+        entt::entity remote;
+        std::uint8_t fields;
+        Transform transform;
+        entt::entity parent = entt::null;
+        SceneNode *node = nullptr;
+    };
+
+    std::unordered_map<entt::entity, entt::entity> m_local;
+    std::unordered_map<entt::entity, entt::entity> m_remote;
+
+    // Replicated states reached, by sequence, starting at the baseline of the
+    // last applied delta. Sequence 0 is the empty scene.
+    std::map<std::uint32_t, SceneDeltaEncoder::SceneState> m_received;
+    std::uint32_t m_sequence = 0;
+
+    const SceneDeltaEncoder::SceneState &state(std::uint32_t sequence) const
+    {
+        static const SceneDeltaEncoder::SceneState empty;
+        return sequence ? m_received.at(sequence) : empty;
+    }
+
+    // Returns the SceneNode of the given encoder entity, or null if there is
+    // none, also if its local entity was destroyed in the meantime.
+    SceneNode *localNode(entt::registry &reg, entt::entity remote) const
+    {
+        const auto local = map(remote);
+        return local != entt::null && reg.valid(local) ? reg.try_get<SceneNode>(local) : nullptr;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Instantiates a FlatScene in resumable steps, so that loading can be spread
+// over several frames. Loading passes through the stages below, each handling
+// one node at a time in FlatScene order. Nodes created so far are visible in
+// the registry while loading; they form the final hierarchy once LinkHierarchy
+// is done. The viewed FlatScene has to outlive the loader.
+class IncrementalSceneLoader
+{
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Stage { CreateEntities, EmplaceNodes, LinkHierarchy, PropagateTransforms, Done };
+
+    // The clock is only read every this many nodes.
+    static constexpr std::size_t deadlineCheckInterval = 64;
+
+    IncrementalSceneLoader(entt::registry &reg, const FlatSceneView &scene, SceneNode *attachTo = nullptr)
+        : m_reg(reg), m_scene(scene), m_attachTo(attachTo), m_entities(scene.size())
+    {
+        if (scene.size() == 0) {
+            m_stage = Stage::Done;
+        }
+    }
+
+    // Handles at most maxNodes nodes, across stages, and stops early once the
+    // deadline has passed. At least deadlineCheckInterval nodes are handled,
+    // within maxNodes, so loading always advances. Returns true once done.
+    bool step(std::size_t maxNodes, Clock::time_point deadline = Clock::time_point::max())
+    {
+        for (std::size_t handled = 0; m_stage != Stage::Done && handled < maxNodes; ++handled) {
+            if (handled > 0 && handled % deadlineCheckInterval == 0 && Clock::now() >= deadline) {
+                break;
+            }
+            handleNext();
+        }
+        return m_stage == Stage::Done;
+    }
+
+    Stage stage() const { return m_stage; }
+
+    // Fraction of the work done, from 0 to 1.
+    float progress() const
+    {
+        if (m_stage == Stage::Done) {
+            return 1.0f;
+        }
+        const auto stages = float(Stage::Done);
+        return (float(m_stage) + float(m_next) / float(m_scene.size())) / stages;
+    }
+
+    // Entities created so far, in FlatScene order.
+    const std::vector<entt::entity> &entities() const { return m_entities; }
+
+  private:
+    entt::registry &m_reg;
+    FlatSceneView m_scene;
+    SceneNode *m_attachTo;
+
+    Stage m_stage = Stage::CreateEntities;
+    std::size_t m_next = 0;
+    std::vector<entt::entity> m_entities;
+
+    void handleNext()
+    {
+        const auto i = m_next;
+
+        switch (m_stage) {
+        case Stage::CreateEntities:
+            m_entities[i] = m_reg.create();
+            break;
+        case Stage::EmplaceNodes: {
+            auto &node = m_reg.emplace<SceneNode>(m_entities[i]);
+            node.setTransform(m_scene.transforms[i]);
+            node.setActive(m_scene.isActive(i));
+            break;
+        }
+        case Stage::LinkHierarchy: {
+            const auto parentIndex = m_scene.parents[i];
+            auto *parent = m_attachTo;
+            if (parentIndex != FlatScene::noParent) {
+                parent = &m_reg.get<SceneNode>(m_entities[parentIndex]);
+            }
+            // Unlike instantiateFlatScene, passes may have run on the still
+            // unlinked node between steps and cached its parent transform as
+            // a root's, which addChild resets.
+            if (parent) {
+                parent->addChild(&m_reg.get<SceneNode>(m_entities[i]));
+            }
+            break;
+        }
+        case Stage::PropagateTransforms:
+            // Parents come first, so each node finds its parent's cache filled.
+            m_reg.get<SceneNode>(m_entities[i]).globalTransform();
+            break;
+        case Stage::Done:
+            return;
+        }
+
+        if (++m_next == m_scene.size()) {
+            m_next = 0;
+            m_stage = Stage(int(m_stage) + 1);
+        }
+    }
+};
+
+// Drives an IncrementalSceneLoader from an entt::scheduler, spending about the
+// given time budget per tick. Succeeds once loading is done.
+class SceneLoadProcess : public entt::process<SceneLoadProcess, std::uint32_t>
+{
+  public:
+    SceneLoadProcess(IncrementalSceneLoader &loader, std::chrono::microseconds budget)
+        : m_loader(loader), m_budget(budget)
+    {
+    }
+
+    void update(std::uint32_t, void *)
+    {
+        if (m_loader.step(~std::size_t(0), IncrementalSceneLoader::Clock::now() + m_budget)) {
+            succeed();
+        }
+    }
+
+  private:
+    IncrementalSceneLoader &m_loader;
+    std::chrono::microseconds m_budget;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Flattened, relocatable copy of a hierarchy, meant to be loaded once and
+// instantiated many times. Besides the FlatScene it holds copies of further
+// components, captured per node. Parent indices are relative to the prefab,
+// so instantiating is a bulk copy of these arrays plus attaching the roots.
+class Prefab
+{
+  public:
+    explicit Prefab(FlatScene scene) : m_scene(std::move(scene)) {}
+
+    // Copies Component from the entities the scene was flattened from, for
+    // the nodes which have one.
+    template <typename Component>
+    void capture(const entt::registry &src)
+    {
+        std::vector<std::uint32_t> nodes;
+        std::vector<Component> components;
+        for (std::uint32_t i = 0; i < m_scene.size(); ++i) {
+            if (const auto *component = src.try_get<Component>(m_scene.entities[i])) {
+                nodes.push_back(i);
+                components.push_back(*component);
+            }
+        }
+
+        m_payloads.push_back([nodes = std::move(nodes), components = std::move(components)](
+                                 entt::registry &reg, const std::vector<entt::entity> &entities) {
+            std::vector<entt::entity> targets(nodes.size());
+            for (std::size_t i = 0; i < nodes.size(); ++i) {
+                targets[i] = entities[nodes[i]];
+            }
+            reg.insert<Component>(targets.begin(), targets.end(), components.begin());
+        });
+    }
+
+    const FlatScene &scene() const { return m_scene; }
+
+    // Creates a copy of the prefab, attached to attachTo if given. Returns the
+    // created entities in FlatScene order, the first root first.
+    std::vector<entt::entity> instantiate(entt::registry &reg, SceneNode *attachTo = nullptr) const
+    {
+        auto entities = instantiateFlatScene(reg, m_scene, attachTo);
+        for (const auto &payload : m_payloads) {
+            payload(reg, entities);
+        }
+        return entities;
+    }
+
+  private:
+    FlatScene m_scene;
+    std::vector<std::function<void(entt::registry &, const std::vector<entt::entity> &)>> m_payloads;
+};
+
+// Loads Prefabs into an entt::resource_cache<Prefab>, either from a subtree of
+// a registry, capturing the listed components too, or from a flat scene file.
+struct PrefabLoader : entt::resource_loader<PrefabLoader, Prefab> {
+    template <typename... Component>
+    std::shared_ptr<Prefab> load(const entt::registry &src, entt::entity root,
+                                 entt::type_list<Component...> = {}) const
+    {
+        FlatScene scene;
+        flattenSubtree(src.get<SceneNode>(root), scene);
+
+        auto prefab = std::make_shared<Prefab>(std::move(scene));
+        (prefab->capture<Component>(src), ...);
+        return prefab;
+    }
+
+    std::shared_ptr<Prefab> load(const std::vector<char> &file) const
+    {
+        FlatScene scene;
+        if (!decodeFlatSceneFile(file.data(), file.size(), scene)) {
+            return nullptr;
+        }
+        scene.entities.assign(scene.size(), entt::null);
+        return std::make_shared<Prefab>(std::move(scene));
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Ring buffer of checkpoints of all SceneNodes' local transforms and parent
+// links, for rolling a scene back several times per frame. A checkpoint is
+// split into pages of pageSize nodes; pages equal to those of the previous
+// checkpoint are shared instead of copied, so checkpoints of a mostly static
+// scene stay cheap.
+//
+// Restoring applies to the nodes of the checkpoint which still exist; nodes
+// created since are left as they are. Children re-linked by a restore are
+// appended to their parent's children.
+class SceneCheckpointRing
+{
+  public:
+    static constexpr std::size_t pageSize = 256;
+
+    explicit SceneCheckpointRing(std::size_t capacity) : m_ring(std::max<std::size_t>(capacity, 1)) {}
+
+    // Captures the scene as checkpoint of the given tick, replacing the
+    // oldest checkpoint once the ring is full.
+    void capture(const entt::registry &reg, std::uint32_t tick)
+    {
+        const auto &previous = m_ring[(m_next + m_ring.size() - 1) % m_ring.size()];
+
+        std::vector<std::shared_ptr<const Page>> pages;
+        Page page;
+        const auto flush = [&] {
+            const auto index = pages.size();
+            if (previous.valid && index < previous.pages.size() && *previous.pages[index] == page) {
+                pages.push_back(previous.pages[index]);
+            } else {
+                pages.push_back(std::make_shared<const Page>(std::move(page)));
+            }
+            page = Page{};
+        };
+
+        for (auto [e, node] : reg.view<const SceneNode>().each()) {
+            page.entities.push_back(e);
+            page.parents.push_back(node.parent() ? node.parent()->entity() : entt::entity(entt::null));
+            page.transforms.push_back(node.transform());
+            if (page.entities.size() == pageSize) {
+                flush();
+            }
+        }
+        if (!page.entities.empty()) {
+            flush();
+        }
+
+        auto &checkpoint = m_ring[m_next];
+        checkpoint.valid = true;
+        checkpoint.tick = tick;
+        checkpoint.pages = std::move(pages);
+        m_next = (m_next + 1) % m_ring.size();
+    }
+
+    // Restores the checkpoint of the given tick. Transforms are written in
+    // bulk, and all cached parent transforms are dropped in one linear pass
+    // afterwards. Returns false if there is no checkpoint of that tick.
+    bool restore(entt::registry &reg, std::uint32_t tick) const
+    {
+        const auto it = std::find_if(m_ring.begin(), m_ring.end(), [tick](const Checkpoint &checkpoint) {
+            return checkpoint.valid && checkpoint.tick == tick;
+        });
+        if (it == m_ring.end()) {
+            return false;
+        }
+
+        std::vector<std::pair<SceneNode *, entt::entity>> relinked;
+        for (const auto &page : it->pages) {
+            for (std::size_t i = 0; i < page->entities.size(); ++i) {
+                auto *node = reg.valid(page->entities[i]) ? reg.try_get<SceneNode>(page->entities[i]) : nullptr;
+                if (!node) {
+                    continue;
+                }
+
+                node->m_transform = page->transforms[i];
+
+                const auto parent = node->m_parent ? node->m_parent->m_entity : entt::entity(entt::null);
+                if (parent != page->parents[i]) {
+                    if (node->m_parent) {
+                        node->m_parent->removeChild(node);
+                    }
+                    relinked.emplace_back(node, page->parents[i]);
+                }
+            }
+        }
+
+        for (const auto &[node, parent] : relinked) {
+            if (parent != entt::null && reg.valid(parent)) {
+                if (auto *parentNode = reg.try_get<SceneNode>(parent)) {
+                    parentNode->addChild(node);
+                }
+            }
+        }
+
+        for (auto [e, node] : reg.view<SceneNode>().each()) {
+            node.m_cachedParentTransform.reset();
+        }
+
+        return true;
+    }
+
+    // Number of distinct pages held by all checkpoints.
+    std::size_t pageCount() const
+    {
+        std::vector<const Page *> pages;
+        for (const auto &checkpoint : m_ring) {
+            for (const auto &page : checkpoint.pages) {
+                pages.push_back(page.get());
+            }
+        }
+        std::sort(pages.begin(), pages.end());
+        return std::size_t(std::unique(pages.begin(), pages.end()) - pages.begin());
+    }
+
+  private:
+    struct Page {
+        std::vector<entt::entity> entities;
+        std::vector<entt::entity> parents;
+        std::vector<Transform> transforms;
+
+        bool operator==(const Page &other) const
+        {
+            return entities == other.entities && parents == other.parents && transforms == other.transforms;
+        }
+    };
+
+    struct Checkpoint {
+        bool valid = false;
+        std::uint32_t tick = 0;
+        std::vector<std::shared_ptr<const Page>> pages;
+    };
+
+    std::vector<Checkpoint> m_ring;
+    std::size_t m_next = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+// Writes a FlatScene as JSON, one node object per line, in FlatScene order:
+//
+//   {"nodes":[
+//   {"parent":-1,"position":[0,1,0]},
+//   {"parent":0,"position":[2.5,0,0],"active":false}
+//   ]}
+//
+// parent is the index of the node's parent, or -1 for roots. active is only
+// written for inactive nodes. Numbers are written in their shortest form which
+// reads back exactly. JSON has no NaN or infinity, so nothing is written and
+// false is returned if any position is not finite.
+bool writeSceneJson(std::ostream &out, const FlatSceneView &scene)
+{
+    for (std::size_t i = 0; i < scene.size(); ++i) {
+        const auto &position = scene.transforms[i].position;
+        if (!std::isfinite(position.x) || !std::isfinite(position.y) || !std::isfinite(position.z)) {
+            return false;
+        }
+    }
+
+    char buffer[128];
+    const auto end = buffer + sizeof(buffer);
+
+    out << "{\"nodes\":[\n";
+    for (std::size_t i = 0; i < scene.size(); ++i) {
+        const auto parent = scene.parents[i] == FlatScene::noParent ? -1 : std::int64_t(scene.parents[i]);
+        const auto &position = scene.transforms[i].position;
+
+        char *p = buffer;
+        p = std::to_chars(p, end, parent).ptr;
+        p = std::copy_n(",\"position\":[", 13, p);
+        p = std::to_chars(p, end, position.x).ptr;
+        *p++ = ',';
+        p = std::to_chars(p, end, position.y).ptr;
+        *p++ = ',';
+        p = std::to_chars(p, end, position.z).ptr;
+
+        *p++ = ']';
+        if (!scene.isActive(i)) {
+            p = std::copy_n(",\"active\":false", 15, p);
+        }
+
+        out << "{\"parent\":";
+        out.write(buffer, p - buffer);
+        out << (i + 1 < scene.size() ? "},\n" : "}\n");
+    }
+    out << "]}\n";
+    return true;
+}
+
+// Reads JSON as written by writeSceneJson into the given FlatScene in a single
+// pass, without building a document tree first. Whitespace and key order are
+// free, other keys are not allowed. Returns false on malformed input or if a
+// node's parent does not come before it, leaving out partially filled.
+bool readSceneJson(const char *data, std::size_t size, FlatScene &out)
+{
+    const char *p = data;
+    const char *const end = data + size;
+
+    const auto skipSpace = [&] {
+        while (p != end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+            ++p;
+        }
+    };
+    const auto consume = [&](char c) {
+        skipSpace();
+        if (p == end || *p != c) {
+            return false;
+        }
+        ++p;
+        return true;
+    };
+    const auto key = [&](std::string_view name) {
+        skipSpace();
+        if (std::size_t(end - p) < name.size() + 2 || p[0] != '"' || std::string_view(p + 1, name.size()) != name
+            || p[name.size() + 1] != '"') {
+            return false;
+        }
+        p += name.size() + 2;
+        return consume(':');
+    };
+    const auto number = [&](auto &value) {
+        skipSpace();
+        const auto result = std::from_chars(p, end, value);
+        p = result.ptr;
+        return result.ec == std::errc();
+    };
+    const auto boolean = [&](bool &value) {
+        skipSpace();
+        for (const std::string_view literal : {"false", "true"}) {
+            if (std::string_view(p, std::min<std::size_t>(end - p, literal.size())) == literal) {
+                value = literal == "true";
+                p += literal.size();
+                return true;
+            }
+        }
+        return false;
+    };
+    const auto member = [&](std::string_view name) {
+        skipSpace();
+        return std::size_t(end - p) > name.size() + 1 && p[0] == '"'
+            && std::string_view(p + 1, name.size()) == name && p[name.size() + 1] == '"';
+    };
+
+    out.entities.clear();
+    out.parents.clear();
+    out.transforms.clear();
+    out.active.clear();
+
+    if (!consume('{') || !key("nodes") || !consume('[')) {
+        return false;
+    }
+
+    skipSpace();
+    bool more = p != end && *p != ']';
+    while (more) {
+        std::int64_t parent = -2;
+        std::optional<Vec3> position;
+        bool active = true;
+
+        if (!consume('{')) {
+            return false;
+        }
+        for (bool members = true; members; members = consume(',')) {
+            if (member("parent")) {
+                if (!key("parent") || !number(parent)) {
+                    return false;
+                }
+            } else if (member("active")) {
+                if (!key("active") || !boolean(active)) {
+                    return false;
+                }
+            } else {
+                position.emplace();
+                if (!key("position") || !consume('[') || !number(position->x) || !consume(',')
+                    || !number(position->y) || !consume(',') || !number(position->z) || !consume(']')) {
+                    return false;
+                }
+            }
+        }
+        if (!consume('}') || !position || parent < -1 || parent >= std::int64_t(out.size())) {
+            return false;
+        }
+
+        out.parents.push_back(parent == -1 ? FlatScene::noParent : std::uint32_t(parent));
+        out.transforms.push_back({*position});
+        if (!active && out.active.empty()) {
+            out.active.assign(out.size() - 1, 1);
+        }
+        if (!out.active.empty()) {
+            out.active.push_back(active);
+        }
+        more = consume(',');
+    }
+
+    out.entities.assign(out.size(), entt::null);
+
+    if (!consume(']') || !consume('}')) {
+        return false;
+    }
+    skipSpace();
+    return p == end;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Timed checks, run with --benchmark on an optimized build, see the bench
+// target of the Makefile. Each prints its throughput next to its target and
+// fails the run if it falls short. Times are the best of several runs.
+int runBenchmarks()
+{
+    using Clock = std::chrono::steady_clock;
+    const auto bestOf = [](int runs, auto &&func) {
+        auto best = Clock::duration::max();
+        for (int i = 0; i < runs; ++i) {
+            const auto start = Clock::now();
+            func();
+            best = std::min(best, Clock::now() - start);
+        }
+        return best;
+    };
+
+    bool met = true;
+    const auto report = [&](const char *name, std::size_t bytes, Clock::duration time, double target) {
+        const auto megabytesPerSecond = double(bytes) / 1e6 / std::chrono::duration<double>(time).count();
+        std::cout << name << ": " << megabytesPerSecond << " MB/s, target " << target << " MB/s\n";
+        met = met && megabytesPerSecond >= target;
+    };
+
+    // JSON round trip of a large generated scene, measured in JSON bytes
+    {
+        FlatScene generated;
+        for (std::uint32_t i = 0; i < 200000; ++i) {
+            generated.parents.push_back(i == 0 ? FlatScene::noParent : (i - 1) / 8);
+            generated.transforms.push_back({{float(i) * 0.37f, float(i % 101) / 7.0f, -float(i % 13) * 1.5f}});
+        }
+
+        std::string text;
+        const auto writeTime = bestOf(5, [&] {
+            std::ostringstream json;
+            writeSceneJson(json, generated.view());
+            text = json.str();
+        });
+
+        FlatScene imported;
+        const auto readTime = bestOf(5, [&] { readSceneJson(text.data(), text.size(), imported); });
+        if (imported.parents != generated.parents || imported.transforms != generated.transforms) {
+            std::cout << "JSON round trip changed the scene\n";
+            return 1;
+        }
+
+        report("JSON write", text.size(), writeTime, 100);
+        report("JSON read", text.size(), readTime, 200);
+    }
+
+    // Decoding a quantized flat scene file, measured in decoded transform
+    // bytes. It has to be faster than reading the raw transforms from a fast
+    // disk at 2 GB/s. Decoding a raw file, i.e. copying it, is listed as well.
+    {
+        FlatScene generated;
+        for (std::uint32_t i = 0; i < 2000000; ++i) {
+            generated.parents.push_back(i == 0 ? FlatScene::noParent : (i - 1) / 8);
+            generated.transforms.push_back({{float(i % 4093) * 0.37f, float(i % 101) / 7.0f, -float(i % 13) * 1.5f}});
+        }
+
+        const auto raw = writeFlatSceneFile(generated.view());
+        const auto quantized = writeFlatSceneFile(generated.view(), 12);
+
+        FlatScene decoded;
+        const auto rawTime = bestOf(5, [&] { decodeFlatSceneFile(raw.data(), raw.size(), decoded); });
+        const auto quantizedTime = bestOf(5, [&] { decodeFlatSceneFile(quantized.data(), quantized.size(), decoded); });
+
+        const auto transformBytes = generated.size() * sizeof(Transform);
+        std::cout << "Raw flat scene decode: "
+                  << double(transformBytes) / 1e6 / std::chrono::duration<double>(rawTime).count() << " MB/s\n";
+        report("12 bit flat scene decode", transformBytes, quantizedTime, 2000);
+    }
+
+    return met ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && std::string_view(argv[1]) == "--benchmark") {
+        return runBenchmarks();
+    }
+
+    entt::registry reg;
+    registerSceneNodeCallbacks(reg);
+
+    // Note the use of pointers for SceneNodes as the SceneNode interface
+    // prefers pointers over references.
+
+    auto ship = reg.create();
+    auto *shipNode = &reg.emplace<SceneNode>(ship);
+
+    auto captain = reg.create();
+    auto *captainNode = &reg.emplace<SceneNode>(captain);
+
+    // connect captain with his ship
+    {
+        shipNode->addChild(captainNode);
+
+        assert(shipNode->children().at(0)->entity() == captain);
+        assert(captainNode->parent()->entity() == ship);
+    }
+
+    // sail the sea
+    {
+        shipNode->setTransform({42, 42, 42});
+
+        assert(captainNode->transform().position.x == 0); // local
+        assert(captainNode->globalTransform().position.x == 42);
+    }
+
+    // ship sinks :(
+    {
+        reg.destroy(ship);
+
+        assert(captainNode->parent() == nullptr);
+        assert(captainNode->transform().position.x == captainNode->globalTransform().position.x);
+    }
+
+    // hand frames over to a render thread
+    {
+        GlobalTransformBuffer frames;
+        frames.write(reg);
+        frames.publish();
+
+        std::thread renderThread([&] {
+            std::uint64_t lastFrame = 0;
+            while (lastFrame < 10) {
+                auto frame = frames.read();
+                assert(frame.frame() >= lastFrame);
+                lastFrame = frame.frame();
+
+                [[maybe_unused]] const auto *transform = frame.find(captain);
+                assert(transform && transform->position.y == float(lastFrame - 1));
+            }
+        });
+
+        for (int i = 1; i < 10; ++i) {
+            captainNode->setTransform({0, float(i), 0});
+            frames.write(reg);
+            frames.publish();
+        }
+
+        renderThread.join();
+
+        // a reader holding on to a frame does not stall the writer
+        const auto held = frames.read();
+        for (int i = 0; i < 3; ++i) {
+            frames.write(reg);
+            frames.publish();
+        }
+        assert(held.frame() == 10 && frames.read().frame() == 13);
+    }
+
+    // unload a whole fleet at once
+    {
+        auto fleet = reg.create();
+        auto *fleetNode = &reg.emplace<SceneNode>(fleet);
+        fleetNode->addChild(captainNode);
+
+        std::vector<entt::entity> crew(64);
+        reg.create(crew.begin(), crew.end());
+        for (std::size_t i = 0; i < crew.size(); ++i) {
+            auto *parentNode = i < 8 ? fleetNode : &reg.get<SceneNode>(crew[i / 8 - 1]);
+            parentNode->addChild(&reg.emplace<SceneNode>(crew[i]));
+        }
+
+        auto harbor = reg.create();
+        reg.emplace<SceneNode>(harbor).addChild(fleetNode);
+
+        destroySubtree(reg, fleet, 4);
+
+        assert(reg.get<SceneNode>(harbor).children().empty());
+        assert(!reg.valid(fleet) && !reg.valid(captain));
+        assert(std::none_of(crew.begin(), crew.end(), [&](auto e) { return reg.valid(e); }));
+
+        reg.destroy(harbor);
+    }
+
+    // keep each island on its own worker
+    {
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+
+        auto addIsland = [&](std::size_t size) {
+            auto island = world.create();
+            auto *islandNode = &world.emplace<SceneNode>(island);
+            islandNode->setTransform({1, 0, 0});
+            for (std::size_t i = 1; i < size; ++i) {
+                auto e = world.create();
+                islandNode->addChild(&world.emplace<SceneNode>(e));
+            }
+            return island;
+        };
+
+        [[maybe_unused]] const auto a = addIsland(4);
+        [[maybe_unused]] const auto b = addIsland(4);
+        const auto c = addIsland(4);
+
+        ScenePartitioner partitioner(2);
+        partitioner.update(world);
+        assert(partitioner.nodes(0).size() == 8 && partitioner.nodes(1).size() == 4);
+        assert(partitioner.partitionOf(a) == partitioner.partitionOf(c));
+
+        // island c grows, island a has to make room
+        auto *cNode = &world.get<SceneNode>(c);
+        for (int i = 0; i < 6; ++i) {
+            cNode->addChild(&world.emplace<SceneNode>(world.create()));
+        }
+        partitioner.update(world);
+        assert(partitioner.partitionOf(c) == 0);
+        [[maybe_unused]] const auto moved = partitioner.rebalance();
+        assert(moved == 1);
+        assert(partitioner.partitionOf(a) == partitioner.partitionOf(b));
+        assert(partitioner.nodes(0).size() == 10 && partitioner.nodes(1).size() == 8);
+
+        std::vector<std::thread> workers;
+        for (std::size_t p = 0; p < partitioner.partitionCount(); ++p) {
+            workers.emplace_back([&, p] {
+                for ([[maybe_unused]] const auto *node : partitioner.nodes(p)) {
+                    assert(node->globalTransform().position.x == 1);
+                }
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    // physics islands write back their results in parallel
+    {
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+
+        std::vector<SceneNode *> bodies;
+        for (int i = 0; i < 4; ++i) {
+            auto *body = &world.emplace<SceneNode>(world.create());
+            body->addChild(&world.emplace<SceneNode>(world.create()));
+            bodies.push_back(body);
+        }
+        (void)bodies[2]->children()[0]->globalTransform();
+
+        TransformDirtyQueue dirty(2);
+        std::vector<std::thread> islands;
+        for (std::size_t i = 0; i < bodies.size(); ++i) {
+            islands.emplace_back([&, i] { bodies[i]->setTransform({float(i), 0, 0}, dirty); });
+        }
+        for (auto &island : islands) {
+            island.join();
+        }
+
+        propagateTransforms(world, dirty);
+
+        for (std::size_t i = 0; i < bodies.size(); ++i) {
+            assert(bodies[i]->children()[0]->globalTransform().position.x == float(i));
+        }
+        [[maybe_unused]] const auto leftOver = dirty.take();
+        assert(leftOver.empty());
+    }
+
+    // build a new district in the background, then splice it in
+    {
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+
+        auto city = world.create();
+        auto *cityNode = &world.emplace<SceneNode>(city);
+        cityNode->setTransform({100, 0, 0});
+
+        entt::registry staging;
+        registerSceneNodeCallbacks(staging);
+
+        std::thread builder([&] {
+            auto district = staging.create();
+            auto *districtNode = &staging.emplace<SceneNode>(district);
+            districtNode->setTransform({0, 10, 0});
+            for (int i = 0; i < 100; ++i) {
+                auto *houseNode = &staging.emplace<SceneNode>(staging.create());
+                houseNode->setTransform({float(i), 0, 0});
+                districtNode->addChild(houseNode);
+            }
+        });
+        builder.join();
+
+        const auto remap = mergeStagedScene(world, staging, cityNode);
+        assert(remap.size() == 101);
+        assert(staging.alive() == 0);
+
+        assert(cityNode->children().size() == 1);
+        [[maybe_unused]] const auto *districtNode = cityNode->children()[0];
+        assert(districtNode->entity() == remap[0].second);
+        assert(districtNode->children().size() == 100);
+        assert(districtNode->children()[7]->globalTransform().position.x == 107);
+        assert(districtNode->children()[7]->globalTransform().position.y == 10);
+    }
+
+    // clear out a whole deck in one go
+    {
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+
+        auto *hull = &world.emplace<SceneNode>(world.create());
+        hull->setTransform({5, 0, 0});
+
+        std::vector<entt::entity> deck(3);
+        world.create(deck.begin(), deck.end());
+        std::vector<SceneNode *> cargo;
+        for (const auto e : deck) {
+            auto *plank = &world.emplace<SceneNode>(e);
+            hull->addChild(plank);
+            cargo.push_back(&world.emplace<SceneNode>(world.create()));
+            plank->addChild(cargo.back());
+        }
+        (void)cargo[0]->globalTransform();
+
+        auto *mast = &world.emplace<SceneNode>(world.create());
+        hull->addChild(mast);
+
+        destroySceneNodes(world, deck.begin(), deck.end());
+
+        assert(hull->children().size() == 1 && hull->children()[0] == mast);
+        for ([[maybe_unused]] const auto *crate : cargo) {
+            assert(!crate->parent());
+            assert(crate->globalTransform().position.x == 0);
+        }
+    }
+
+    // only moving nodes are propagated
+    {
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+
+        std::vector<entt::entity> buoys(100);
+        world.create(buoys.begin(), buoys.end());
+        for (const auto e : buoys) {
+            auto *buoyNode = &world.emplace<SceneNode>(e);
+            buoyNode->addChild(&world.emplace<SceneNode>(world.create()));
+            (void)buoyNode->children()[0]->globalTransform();
+        }
+
+        entt::observer moved{world, entt::collector.update<SceneNode>()};
+
+        patchTransform(world, buoys[42], {0, 0, 3});
+        assert(moved.size() == 1);
+
+        propagateTransforms(world, moved);
+        assert(moved.empty());
+        assert(world.get<SceneNode>(buoys[42]).children()[0]->globalTransform().position.z == 3);
+        assert(world.get<SceneNode>(buoys[41]).children()[0]->globalTransform().position.z == 0);
+
+        // tell the audio system which emitters moved
+        struct AudioSystem {
+            std::size_t batches = 0;
+            std::vector<entt::entity> moved;
+
+            void onTransformsChanged(const TransformsChanged &event)
+            {
+                ++batches;
+                moved.insert(moved.end(), event.entities.begin(), event.entities.end());
+            }
+        } audio;
+
+        entt::dispatcher events;
+        events.sink<TransformsChanged>().connect<&AudioSystem::onTransformsChanged>(audio);
+
+        patchTransform(world, buoys[1], {1, 0, 0});
+        patchTransform(world, buoys[2], {2, 0, 0});
+        propagateTransforms(world, moved, &events);
+        propagateTransforms(world, moved, &events);
+        events.update();
+
+        assert(audio.batches == 1);
+        assert(audio.moved.size() == 4);
+        assert(std::count(audio.moved.begin(), audio.moved.end(), buoys[2]) == 1);
+    }
+
+    // keep track of the whole scene
+    {
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+        const auto &graph = world.ctx<SceneGraph>();
+
+        auto *sun = &world.emplace<SceneNode>(world.create());
+        auto *planet = &world.emplace<SceneNode>(world.create());
+        auto *moon = &world.emplace<SceneNode>(world.create());
+        assert(graph.roots().size() == 3 && graph.nodeCount() == 3);
+        assert(graph.maxDepth() == 0);
+
+        sun->addChild(planet);
+        planet->addChild(moon);
+        assert(graph.roots().size() == 1 && graph.roots()[0] == sun);
+        assert(graph.maxDepth() == 2);
+
+        std::vector<const SceneNode *> visited;
+        graph.forEachNode([&](const SceneNode &node) { visited.push_back(&node); });
+        assert((visited == std::vector<const SceneNode *>{sun, planet, moon}));
+
+        world.destroy(planet->entity());
+        assert(graph.roots().size() == 2 && graph.nodeCount() == 2);
+        assert(graph.maxDepth() == 0);
+    }
+
+    // register with a registry which already has SceneNodes
+    {
+        entt::registry world;
+
+        auto *sun = &world.emplace<SceneNode>(world.create());
+        auto *planet = &world.emplace<SceneNode>(world.create());
+        sun->addChild(planet);
+
+        registerSceneNodeCallbacks(world);
+        registerSceneNodeCallbacks(world);
+        [[maybe_unused]] const auto &graph = world.ctx<SceneGraph>();
+        assert(graph.nodeCount() == 2 && graph.roots().size() == 1 && graph.maxDepth() == 1);
+        assert(planet->entity() == world.view<SceneNode>().front());
+
+        auto *moon = &world.emplace<SceneNode>(world.create());
+        planet->addChild(moon);
+        assert(graph.nodeCount() == 3 && graph.maxDepth() == 2 && graph.nodesAtDepth(2).size() == 1);
+
+        entt::registry copy;
+        registerSceneNodeCallbacks(copy);
+        loadScene(copy, saveScene(world));
+        assert(copy.ctx<SceneGraph>().nodeCount() == 3);
+    }
+
+    // hand packed transforms to the renderer
+    {
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+
+        auto *leaf = &world.emplace<SceneNode>(world.create());
+        auto *branch = &world.emplace<SceneNode>(world.create());
+        auto *tree = &world.emplace<SceneNode>(world.create());
+        tree->setTransform({0, 2, 0});
+        branch->setTransform({0, 1, 0});
+        tree->addChild(branch);
+        branch->addChild(leaf);
+
+        updateTransformGroup(world);
+
+        std::vector<float> heights;
+        std::vector<std::uint32_t> depths;
+        transformGroup(world).each([&](const GlobalTransform &global, const HierarchyOrder &order) {
+            heights.push_back(global.value.position.y);
+            depths.push_back(order.depth);
+        });
+        assert((heights == std::vector<float>{2, 3, 3}));
+        assert((depths == std::vector<std::uint32_t>{0, 1, 2}));
+
+        world.remove<SceneNode>(leaf->entity());
+        assert(transformGroup(world).size() == 2);
+
+        // small edits are repaired in place
+        std::vector<entt::entity> forest(100);
+        world.create(forest.begin(), forest.end());
+        for (const auto e : forest) {
+            world.emplace<SceneNode>(e);
+        }
+        [[maybe_unused]] auto sort = updateTransformGroup(world);
+        assert(sort == TransformGroupSort::Full);
+        sort = updateTransformGroup(world);
+        assert(sort == TransformGroupSort::None);
+
+        world.get<SceneNode>(forest[3]).addChild(&world.get<SceneNode>(forest[50]));
+        sort = updateTransformGroup(world);
+        assert(sort == TransformGroupSort::Insertion);
+
+        std::uint32_t previous = 0;
+        transformGroup(world).each([&](const GlobalTransform &, const HierarchyOrder &order) {
+            assert(order.index == 0 || order.index == previous + 1);
+            previous = order.index;
+        });
+
+        // destroying a root moves the last root's subtree to the front, which
+        // leaves few neighbors out of order but takes many shifts to repair
+        for (std::size_t i = 0; i < forest.size(); ++i) {
+            for (int j = 0; j < 20; ++j) {
+                world.get<SceneNode>(forest[i]).addChild(&world.emplace<SceneNode>(world.create()));
+            }
+        }
+        updateTransformGroup(world);
+        destroySubtree(world, forest[0]);
+        sort = updateTransformGroup(world);
+        assert(sort == TransformGroupSort::Full);
+    }
+
+    // every match gets its own copy of the arena
+    {
+        entt::registry authored;
+        registerSceneNodeCallbacks(authored);
+
+        auto arena = authored.create();
+        auto *arenaNode = &authored.emplace<SceneNode>(arena);
+        for (int i = 0; i < 4; ++i) {
+            auto *pillar = &authored.emplace<SceneNode>(authored.create());
+            pillar->setTransform({float(i), 0, 0});
+            pillar->addChild(&authored.emplace<SceneNode>(authored.create()));
+            arenaNode->addChild(pillar);
+            pillar->setActive(i != 3);
+        }
+
+        entt::registry match;
+        registerSceneNodeCallbacks(match);
+
+        auto world = match.create();
+        match.emplace<SceneNode>(world).setTransform({0, 0, 7});
+
+        const auto copy = cloneSubtree(authored, arena, match, world);
+        [[maybe_unused]] const auto &copyNode = match.get<SceneNode>(copy);
+        assert(copyNode.parent()->entity() == world);
+        assert(copyNode.children().size() == 4);
+        assert(copyNode.children()[2]->children()[0]->globalTransform().position.x == 2);
+        assert(copyNode.children()[2]->children()[0]->globalTransform().position.z == 7);
+        assert(!copyNode.children()[3]->active() && copyNode.children()[2]->active());
+        assert(match.ctx<SceneGraph>().nodeCount() == 10);
+        assert(authored.ctx<SceneGraph>().nodeCount() == 9);
+    }
+
+    // gameplay code works with handles
+    {
+        struct Health {
+            int points = 100;
+        };
+
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+
+        auto knight = world.create();
+        world.emplace<SceneNode>(knight);
+        world.emplace<Health>(knight);
+
+        auto horse = world.create();
+        world.emplace<SceneNode>(horse).addChild(&world.get<SceneNode>(knight));
+        world.emplace<Health>(horse, 300);
+
+        SceneHandle<Health> rider(world, knight);
+        for (int i = 0; i < 10; ++i) {
+            rider.get<Health>().points -= 1;
+            rider.parent().get<Health>().points -= 2;
+        }
+
+        assert(world.get<Health>(knight).points == 90);
+        assert(world.get<Health>(horse).points == 280);
+        assert(rider.parent().child(0).entity() == knight);
+        assert(!rider.parent().parent());
+        assert(&rider.get<SceneNode>() == &rider.node());
+    }
+
+    // level by level
+    {
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+        [[maybe_unused]] const auto &graph = world.ctx<SceneGraph>();
+
+        std::vector<SceneNode *> chain;
+        for (int i = 0; i < 4; ++i) {
+            chain.push_back(&world.emplace<SceneNode>(world.create()));
+            if (i > 0) {
+                chain[i - 1]->addChild(chain[i]);
+            }
+        }
+        auto *sibling = &world.emplace<SceneNode>(world.create());
+        chain[1]->addChild(sibling);
+
+        assert(graph.maxDepth() == 3 && chain[3]->depth() == 3);
+        assert(graph.nodesAtDepth(2).size() == 2);
+
+        // hanging the chain below another tree shifts all of it
+        auto *anchor = &world.emplace<SceneNode>(world.create());
+        auto *post = &world.emplace<SceneNode>(world.create());
+        anchor->addChild(post);
+        post->addChild(chain[0]);
+
+        assert(graph.maxDepth() == 5 && chain[3]->depth() == 5 && sibling->depth() == 4);
+        assert(graph.nodesAtDepth(0).size() == 1 && graph.nodesAtDepth(0)[0] == anchor);
+        assert(graph.nodesAtDepth(4).size() == 2);
+
+        post->removeChild(chain[0]);
+        world.destroy(chain[2]->entity());
+        assert(graph.maxDepth() == 2 && graph.nodesAtDepth(2) == std::vector<SceneNode *>{sibling});
+        assert(chain[3]->depth() == 0);
+    }
+
+    // streamed in, but not shown yet
+    {
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+        const auto &graph = world.ctx<SceneGraph>();
+
+        auto *island = &world.emplace<SceneNode>(world.create());
+        auto *cave = &world.emplace<SceneNode>(world.create());
+        auto *treasure = &world.emplace<SceneNode>(world.create());
+        island->addChild(cave);
+        cave->addChild(treasure);
+        auto *ocean = &world.emplace<SceneNode>(world.create());
+        updateTransformGroup(world);
+
+        cave->setActive(false);
+        assert(!treasure->activeInHierarchy() && treasure->active());
+
+        std::size_t visited = 0;
+        graph.forEachNode([&](const SceneNode &) { ++visited; });
+        assert(visited == 2);
+
+        ocean->setActive(false);
+        assert(graph.activeRootCount() == 1 && graph.roots()[0] == island);
+
+        updateTransformGroup(world);
+        assert(transformGroup(world).size() == 1);
+
+        // moving the island does not reach into the cave until it is shown
+        TransformDirtyQueue dirty;
+        (void)treasure->globalTransform();
+        island->setTransform({0, 4, 0}, dirty);
+        TransformsChanged changed;
+        const auto moved = dirty.take();
+        collectPropagatedTransforms(world, moved.begin(), moved.end(), &changed);
+        assert(changed.entities.size() == 1);
+
+        cave->setActive(true);
+        assert(treasure->globalTransform().position.y == 4);
+    }
+
+    // save and load the game
+    {
+        entt::registry saved;
+        registerSceneNodeCallbacks(saved);
+
+        auto *castle = &saved.emplace<SceneNode>(saved.create());
+        castle->setTransform({10, 0, 0});
+        std::vector<SceneNode *> towers;
+        for (int i = 0; i < 3; ++i) {
+            towers.push_back(&saved.emplace<SceneNode>(saved.create()));
+            towers.back()->setTransform({0, float(i), 0});
+            castle->addChild(towers.back());
+        }
+        towers[1]->setActive(false);
+        saved.destroy(saved.create());
+
+        const auto bytes = saveScene(saved);
+
+        entt::registry loaded;
+        registerSceneNodeCallbacks(loaded);
+        loadScene(loaded, bytes);
+
+        const auto &castleCopy = loaded.get<SceneNode>(castle->entity());
+        assert(castleCopy.children().size() == 3);
+        for (std::size_t i = 0; i < 3; ++i) {
+            [[maybe_unused]] const auto *tower = castleCopy.children()[i];
+            assert(tower->entity() == towers[i]->entity());
+            assert(tower->globalTransform().position.x == 10 && tower->globalTransform().position.y == float(i));
+            assert(tower->active() == towers[i]->active() && tower->depth() == 1);
+        }
+        assert(loaded.ctx<SceneGraph>().roots().size() == 1 && loaded.ctx<SceneGraph>().nodeCount() == 4);
+        // the free list of destroyed entities carries over, too
+        [[maybe_unused]] const auto loadedNext = loaded.create();
+        [[maybe_unused]] const auto savedNext = saved.create();
+        assert(loadedNext == savedNext);
+    }
+
+    // save a scene after heavy churn
+    {
+        entt::registry churned;
+        registerSceneNodeCallbacks(churned);
+
+        std::vector<SceneNode *> nodes;
+        for (int i = 0; i < 64; ++i) {
+            nodes.push_back(&churned.emplace<SceneNode>(churned.create()));
+            if (i > 0) {
+                nodes[(i - 1) / 2]->addChild(nodes.back());
+            }
+        }
+        for (int i = 63; i >= 32; i -= 3) {
+            churned.destroy(nodes[i]->entity());
+        }
+        destroySubtree(churned, nodes[2]->entity());
+        assert(churned.size<SceneNode>() == 64);
+
+        [[maybe_unused]] const auto liveCount = churned.ctx<SceneGraph>().nodeCount();
+        std::vector<entt::entity> hierarchyOrder;
+        appendSubtreeOrder(*nodes[0], hierarchyOrder);
+        assert(hierarchyOrder.size() == liveCount);
+
+        entt::registry loaded;
+        registerSceneNodeCallbacks(loaded);
+        loadScene(loaded, saveScene(churned));
+
+        // views of the loaded pool visit parents first and no tombstones
+        const auto view = loaded.view<SceneNode>();
+        [[maybe_unused]] const std::vector<entt::entity> visited(view.begin(), view.end());
+        assert(loaded.size<SceneNode>() == liveCount && visited == hierarchyOrder);
+    }
+
+    // stream world cells in and out
+    {
+        entt::registry disk;
+        registerSceneNodeCallbacks(disk);
+
+        auto *cell = &disk.emplace<SceneNode>(disk.create());
+        auto *house = &disk.emplace<SceneNode>(disk.create());
+        auto *door = &disk.emplace<SceneNode>(disk.create());
+        house->setTransform({1, 0, 0});
+        door->setTransform({0, 0, 1});
+        cell->addChild(house);
+        house->addChild(door);
+        const auto bytes = saveSubtree(disk, cell->entity());
+
+        entt::registry world;
+        registerSceneNodeCallbacks(world);
+        auto *worldRoot = &world.emplace<SceneNode>(world.create());
+        auto *landmark = &world.emplace<SceneNode>(world.create());
+        worldRoot->addChild(landmark);
+
+        std::vector<std::vector<entt::entity>> cells;
+        for (int i = 0; i < 3; ++i) {
+            cells.push_back(loadSubtree(world, bytes, worldRoot));
+            world.get<SceneNode>(cells.back().front()).setTransform({0, 0, float(10 * i)});
+        }
+        assert(worldRoot->children().size() == 4 && landmark->parent() == worldRoot);
+
+        for (int i = 0; i < 3; ++i) {
+            [[maybe_unused]] const auto &cellDoor = world.get<SceneNode>(cells[i].back());
+            assert(cellDoor.parent()->parent()->entity() == cells[i].front());
+            assert(cellDoor.globalTransform().position.x == 1 && cellDoor.globalTransform().position.z == 10 * i + 1);
+        }
+
+        destroySubtree(world, cells[1].front());
+        assert(worldRoot->children().size() == 3 && world.ctx<SceneGraph>().nodeCount() == 8);
+    }
+
+    // map a level file and instantiate it
+    {
+        FlatScene level;
+        level.parents = {FlatScene::noParent, 0, 0, 1};
+        level.transforms = {{{0, 1, 0}}, {{1, 0, 0}}, {{2, 0, 0}}, {{0, 0, 3}}};
+        level.active = {1, 1, 0, 1};
+
+        const auto bytes = writeFlatSceneFile(level.view());
+        assert(readFlatSceneFile(bytes.data(), bytes.size())->size() == 4);
+        assert(!readFlatSceneFile(bytes.data(), sizeof(FlatSceneFileHeader) - 1));
+
+        auto crafted = bytes;
+        FlatSceneFileHeader craftedHeader;
+        std::memcpy(&craftedHeader, crafted.data(), sizeof(craftedHeader));
+        craftedHeader.parentsOffset = ~std::uint64_t(0) - 7;
+        craftedHeader.transformsOffset = ~std::uint64_t(0) - 3;
+        std::memcpy(crafted.data(), &craftedHeader, sizeof(craftedHeader));
+        assert(!readFlatSceneFile(crafted.data(), crafted.size()));
+
+        const char *path = "level.esgf";
+        [[maybe_unused]] const bool saved = saveFlatSceneFile(path, level.view());
+        assert(saved);
+        {
+            MappedFlatSceneFile file(path);
+            assert(file.scene() && file.scene()->transforms[3].position.z == 3);
+
+            entt::registry levelReg;
+            registerSceneNodeCallbacks(levelReg);
+            const auto entities = instantiateFlatScene(levelReg, *file.scene());
+            [[maybe_unused]] const auto &leaf = levelReg.get<SceneNode>(entities[3]);
+            assert(leaf.depth() == 2 && leaf.globalTransform().position.x == 1);
+            assert(leaf.globalTransform().position.y == 1 && leaf.globalTransform().position.z == 3);
+            assert(!levelReg.get<SceneNode>(entities[2]).active() && leaf.active());
+        }
+        std::remove(path);
+
+        // quantized positions take fewer bits with lower precision
+        FlatScene terrain;
+        for (std::uint32_t i = 0; i < 1000; ++i) {
+            terrain.parents.push_back(i == 0 ? FlatScene::noParent : 0);
+            terrain.transforms.push_back({{float(i % 37), float(i % 11) * 0.5f, -float(i % 100) * 0.1f}});
+        }
+
+        const auto raw = writeFlatSceneFile(terrain.view());
+        const auto quantized16 = writeFlatSceneFile(terrain.view(), 16);
+        const auto quantized12 = writeFlatSceneFile(terrain.view(), 12);
+        assert(quantized12.size() < quantized16.size() && quantized16.size() < raw.size());
+        assert(!readFlatSceneFile(quantized12.data(), quantized12.size()));
+
+        // the error stays within half a step, 36 / (2^bits - 1) / 2 along x
+        for (const auto &[bytes, tolerance] : {std::pair{&quantized16, 0.001f}, std::pair{&quantized12, 0.005f}}) {
+            FlatScene decoded;
+            [[maybe_unused]] const bool decodedOk = decodeFlatSceneFile(bytes->data(), bytes->size(), decoded);
+            assert(decodedOk && decoded.parents == terrain.parents);
+            for (std::size_t i = 0; i < terrain.size(); ++i) {
+                [[maybe_unused]] const auto &a = decoded.transforms[i].position;
+                [[maybe_unused]] const auto &b = terrain.transforms[i].position;
+                assert(std::abs(a.x - b.x) <= tolerance && std::abs(a.y - b.y) <= tolerance);
+                assert(std::abs(a.z - b.z) <= tolerance);
+            }
+        }
+
+        // each axis gets its own precision, here 5 / 15 / 2 along y
+        const auto perAxis = writeFlatSceneFile(terrain.view(), {16, 4, 10});
+        assert(perAxis.size() < quantized12.size());
+        FlatScene decoded;
+        [[maybe_unused]] const bool decodedOk = decodeFlatSceneFile(perAxis.data(), perAxis.size(), decoded);
+        assert(decodedOk);
+        for (std::size_t i = 0; i < terrain.size(); ++i) {
+            [[maybe_unused]] const auto &a = decoded.transforms[i].position;
+            [[maybe_unused]] const auto &b = terrain.transforms[i].position;
+            assert(std::abs(a.x - b.x) <= 0.001f && std::abs(a.y - b.y) <= 0.17f && std::abs(a.z - b.z) <= 0.005f);
+        }
+    }
+
+    // replicate a scene to a client
+    {
+        entt::registry server;
+        registerSceneNodeCallbacks(server);
+        entt::registry client;
+        registerSceneNodeCallbacks(client);
+
+        SceneDeltaEncoder encoder;
+        SceneDeltaDecoder decoder;
+
+        auto *track = &server.emplace<SceneNode>(server.create());
+        auto *car = &server.emplace<SceneNode>(server.create());
+        auto *driver = &server.emplace<SceneNode>(server.create());
+        track->addChild(car);
+        car->addChild(driver);
+        car->setTransform({0, 0, 5});
+        // the client reports back which state it reached
+        const auto send = [&](const std::vector<char> &delta) {
+            const bool applied = decoder.apply(client, delta);
+            encoder.acknowledge(decoder.sequence());
+            return applied;
+        };
+
+        [[maybe_unused]] bool applied = send(encoder.encode(server));
+        assert(applied);
+
+        [[maybe_unused]] const auto &clientDriver = client.get<SceneNode>(decoder.map(driver->entity()));
+        assert(clientDriver.globalTransform().position.z == 5);
+
+        // nothing changed, nothing but the sequences and the empty removal and
+        // record lists is sent
+        const auto unchanged = encoder.encode(server);
+        assert(unchanged.size() == 4 * sizeof(std::uint32_t));
+        applied = send(unchanged);
+        assert(applied);
+
+        car->setTransform({0, 0, 6});
+        car->removeChild(driver);
+        auto *flag = &server.emplace<SceneNode>(server.create());
+        track->addChild(flag);
+        flag->addChild(driver);
+        flag->setTransform({1, 0, 0});
+        applied = send(encoder.encode(server));
+        assert(applied);
+
+        [[maybe_unused]] const auto &clientCar = client.get<SceneNode>(decoder.map(car->entity()));
+        assert(clientCar.globalTransform().position.z == 6);
+        assert(clientDriver.parent()->entity() == decoder.map(flag->entity()));
+        assert(clientDriver.globalTransform().position.x == 1 && clientDriver.globalTransform().position.z == 0);
+
+        server.destroy(flag->entity());
+        applied = send(encoder.encode(server));
+        assert(applied && decoder.map(flag->entity()) == entt::null);
+        assert(!clientDriver.parent() && client.alive() == 3);
+
+        // swapping a parent and its child in one delta
+        track->removeChild(car);
+        car->addChild(track);
+        applied = send(encoder.encode(server));
+        assert(applied);
+        [[maybe_unused]] const auto &clientTrack = client.get<SceneNode>(decoder.map(track->entity()));
+        assert(clientTrack.parent() == &clientCar && !clientCar.parent());
+
+        // lost deltas are covered by the next one, as they share the baseline
+        car->setTransform({0, 0, 8});
+        encoder.encode(server);
+        car->setTransform({0, 0, 9});
+        applied = send(encoder.encode(server));
+        assert(applied && clientCar.transform().position.z == 9);
+
+        // late deltas are dropped
+        car->setTransform({0, 0, 10});
+        const auto late = encoder.encode(server);
+        car->setTransform({0, 0, 11});
+        applied = send(encoder.encode(server));
+        assert(applied);
+        applied = send(late);
+        assert(!applied && clientCar.transform().position.z == 11);
+
+        // deltas sent before the last one was acknowledged still apply, even
+        // if they undo a change relative to their baseline
+        car->setTransform({0, 0, 12});
+        const auto ahead = encoder.encode(server);
+        car->setTransform({0, 0, 11});
+        const auto back = encoder.encode(server);
+        applied = decoder.apply(client, ahead) && decoder.apply(client, back);
+        encoder.acknowledge(decoder.sequence());
+        assert(applied && clientCar.transform().position.z == 11);
+
+        // truncated or malformed deltas are rejected without changes
+        car->setTransform({0, 0, 7});
+        auto truncated = encoder.encode(server);
+        truncated.pop_back();
+        applied = send(truncated);
+        assert(!applied && clientCar.transform().position.z == 11);
+
+        std::vector<char> unknownParent;
+        ByteWriter writer(unknownParent);
+        writer.write(decoder.sequence());
+        writer.write(decoder.sequence() + 1);
+        writer.write(std::uint32_t(0));
+        writer.write(std::uint32_t(1));
+        writer.write(car->entity());
+        writer.write(SceneDeltaEncoder::parentChanged);
+        writer.write(entt::entity(12345));
+        applied = decoder.apply(client, unknownParent);
+        assert(!applied && !clientCar.parent());
+
+        std::vector<char> cycle;
+        ByteWriter cycleWriter(cycle);
+        cycleWriter.write(decoder.sequence());
+        cycleWriter.write(decoder.sequence() + 1);
+        cycleWriter.write(std::uint32_t(0));
+        cycleWriter.write(std::uint32_t(1));
+        cycleWriter.write(car->entity());
+        cycleWriter.write(SceneDeltaEncoder::parentChanged);
+        cycleWriter.write(track->entity());
+        applied = decoder.apply(client, cycle);
+        assert(!applied && !clientCar.parent());
+    }
+
+    // spawn prefabs from a cache
+    {
+        struct Loot {
+            int gold = 0;
+        };
+
+        entt::registry source;
+        registerSceneNodeCallbacks(source);
+        auto *chest = &source.emplace<SceneNode>(source.create());
+        auto *lid = &source.emplace<SceneNode>(source.create());
+        chest->addChild(lid);
+        lid->setTransform({0, 1, 0});
+        source.emplace<Loot>(chest->entity(), 50);
+
+        entt::resource_cache<Prefab> prefabs;
+        const auto chestId = entt::hashed_string::value("chest");
+        auto prefab = prefabs.load<PrefabLoader>(chestId, source, chest->entity(), entt::type_list<Loot>{});
+        // loading an id again returns the cached prefab
+        [[maybe_unused]] const auto cached = prefabs.load<PrefabLoader>(chestId, source, lid->entity());
+        assert(cached->scene().size() == 2);
+
+        const auto file = writeFlatSceneFile(prefab->scene().view());
+        const auto barrelId = entt::hashed_string::value("barrel");
+        const auto barrelPrefab = prefabs.load<PrefabLoader>(barrelId, file);
+        assert(barrelPrefab && prefabs.size() == 2);
+
+        entt::registry dungeon;
+        registerSceneNodeCallbacks(dungeon);
+        auto *room = &dungeon.emplace<SceneNode>(dungeon.create());
+        room->setTransform({0, 0, 7});
+        for (int i = 0; i < 100; ++i) {
+            prefab->instantiate(dungeon, room);
+        }
+        const auto barrel = barrelPrefab->instantiate(dungeon);
+
+        assert(room->children().size() == 100 && dungeon.ctx<SceneGraph>().nodeCount() == 203);
+        assert(dungeon.view<Loot>().size() == 100 && !dungeon.all_of<Loot>(barrel.front()));
+        [[maybe_unused]] const auto &chestLid = *room->children().back()->children().front();
+        assert(chestLid.globalTransform().position.y == 1 && chestLid.globalTransform().position.z == 7);
+        assert(dungeon.get<Loot>(room->children().back()->entity()).gold == 50);
+    }
+
+    // roll back a match
+    {
+        entt::registry match;
+        registerSceneNodeCallbacks(match);
+
+        auto *field = &match.emplace<SceneNode>(match.create());
+        std::vector<SceneNode *> players;
+        for (int i = 0; i < 1000; ++i) {
+            players.push_back(&match.emplace<SceneNode>(match.create()));
+            players.back()->setTransform({float(i), 0, 0});
+            field->addChild(players.back());
+        }
+        auto *ball = &match.emplace<SceneNode>(match.create());
+        players[10]->addChild(ball);
+        field->setTransform({0, 0, 1});
+
+        SceneCheckpointRing checkpoints(4);
+        checkpoints.capture(match, 0);
+        [[maybe_unused]] const auto pagesPerCheckpoint = checkpoints.pageCount();
+
+        players[999]->setTransform({0, 5, 0});
+        checkpoints.capture(match, 1);
+        assert(checkpoints.pageCount() == pagesPerCheckpoint + 1);
+
+        players[10]->removeChild(ball);
+        players[20]->addChild(ball);
+        field->setTransform({0, 0, 2});
+        players[20]->setTransform({0, 3, 0});
+        assert(ball->globalTransform().position.y == 3 && ball->globalTransform().position.z == 2);
+
+        [[maybe_unused]] bool restored = checkpoints.restore(match, 0);
+        assert(restored);
+        assert(ball->parent() == players[10] && players[20]->children().empty());
+        assert(ball->globalTransform().position.x == 10 && ball->globalTransform().position.z == 1);
+        assert(players[999]->globalTransform().position.x == 999);
+        restored = checkpoints.restore(match, 7);
+        assert(!restored);
+
+        for (std::uint32_t tick = 2; tick < 6; ++tick) {
+            checkpoints.capture(match, tick);
+        }
+        restored = checkpoints.restore(match, 1);
+        assert(!restored && checkpoints.pageCount() == pagesPerCheckpoint);
+    }
+
+    // exchange scenes with the content pipeline
+    {
+        FlatScene exported;
+        exported.parents = {FlatScene::noParent, 0, 1, 0};
+        exported.transforms = {{{0.1f, 0, 0}}, {{-2, 1e-7f, 3}}, {{0, 0, 1}}, {{100000, 0.5f, -0.25f}}};
+        exported.active = {1, 0, 1, 1};
+
+        std::ostringstream json;
+        [[maybe_unused]] bool written = writeSceneJson(json, exported.view());
+        assert(written);
+        const auto text = json.str();
+
+        FlatScene imported;
+        [[maybe_unused]] bool parsed = readSceneJson(text.data(), text.size(), imported);
+        assert(parsed);
+        assert(imported.parents == exported.parents && imported.transforms == exported.transforms);
+        assert(imported.active == exported.active);
+
+        exported.transforms[2].position.y = std::nanf("");
+        std::ostringstream invalid;
+        written = writeSceneJson(invalid, exported.view());
+        assert(!written && invalid.str().empty());
+
+        const std::string_view handWritten = R"({ "nodes": [ { "position": [1, 2, 3], "parent": -1 },
+                                                             { "parent": 0, "position": [0, 0, 1] } ] })";
+        const std::string_view forwardParent = R"({"nodes":[{"parent":1,"position":[0,0,0]}]})";
+        parsed = readSceneJson(forwardParent.data(), forwardParent.size(), imported);
+        assert(!parsed);
+        parsed = readSceneJson(handWritten.data(), handWritten.size() - 1, imported);
+        assert(!parsed);
+        parsed = readSceneJson(handWritten.data(), handWritten.size(), imported);
+        assert(parsed && imported.size() == 2);
+
+        entt::registry pipeline;
+        registerSceneNodeCallbacks(pipeline);
+        const auto entities = instantiateFlatScene(pipeline, imported);
+        assert(pipeline.get<SceneNode>(entities[1]).globalTransform().position.z == 4);
+    }
+
+    // load a level over several frames
+    {
+        FlatScene level;
+        for (std::uint32_t i = 0; i < 1000; ++i) {
+            level.parents.push_back(i == 0 ? FlatScene::noParent : (i - 1) / 4);
+            level.transforms.push_back({{1, 0, 0}});
+        }
+
+        entt::registry levelReg;
+        registerSceneNodeCallbacks(levelReg);
+
+        IncrementalSceneLoader loader(levelReg, level.view());
+        int frames = 0;
+        for ([[maybe_unused]] float progress = 0; !loader.step(128); ++frames) {
+            assert(loader.progress() > progress);
+            progress = loader.progress();
+        }
+        assert(frames == 4000 / 128 && loader.progress() == 1.0f);
+
+        [[maybe_unused]] const auto &last = levelReg.get<SceneNode>(loader.entities().back());
+        assert(last.depth() == 5 && last.globalTransform().position.x == 6);
+
+        IncrementalSceneLoader timedLoader(levelReg, level.view(), &levelReg.get<SceneNode>(loader.entities()[0]));
+        entt::scheduler<std::uint32_t> scheduler;
+        scheduler.attach<SceneLoadProcess>(timedLoader, std::chrono::microseconds(200));
+        while (!scheduler.empty()) {
+            scheduler.update(16);
+        }
+        assert(levelReg.ctx<SceneGraph>().nodeCount() == 2000 && levelReg.ctx<SceneGraph>().maxDepth() == 6);
+
+        // whole-scene passes may run between steps
+        FlatScene pair;
+        pair.parents = {FlatScene::noParent, 0};
+        pair.transforms = {{{5, 0, 0}}, {{1, 0, 0}}};
+
+        entt::registry pairReg;
+        registerSceneNodeCallbacks(pairReg);
+        GlobalTransformBuffer transforms;
+        IncrementalSceneLoader pairLoader(pairReg, pair.view());
+        while (!pairLoader.step(1)) {
+            transforms.write(pairReg);
+            transforms.publish();
+        }
+        assert(pairReg.get<SceneNode>(pairLoader.entities()[1]).globalTransform().position.x == 6);
     }
 }